@@ -31,8 +31,17 @@ struct fd_info;
 #include <lib/uevent.h>
 #include <lib/klog.h>
 #include <lib/fs.h>
+#include <lib/hash.h>
+#include <lib/path_trie.h>
+#include <lib/path_cache.h>
+#include <lib/fstype_cache.h>
+#include <lib/fd_table.h>
+#include <lib/fstab_index.h>
+#include <lib/copy_tree.h>
 #include <blkid.h>
 #include <util.h>
+#include <rc_patch.h>
+#include <init_graph.h>
 #include <modules.h>
 
 #if __GNUC__ == 3
@@ -68,13 +77,22 @@ struct fd_info;
 #define INFO(x...)    KLOG_INFO(LOG_TAG, x)
 #define DEBUG(x...)   KLOG_DEBUG(LOG_TAG, x)
 
+#define SCRATCH_SLOTS 4
+#define SCRATCH_SLOT_SIZE PATH_MAX
+#define SCRATCH_SIZE (SCRATCH_SLOTS * SCRATCH_SLOT_SIZE)
+
 struct multiboot_child_data {
 	tracy_child_addr_t memory;
 	char *tmp;
 
+	// scratch arena for path arguments
+	tracy_child_addr_t scratch;
+	unsigned scratch_used;
+
 	// fs_redirection
-	struct tracy_ll *files;
+	struct fd_table files;
 	bool handled_by_open;
+	bool tmp_cloexec;
 };
 
 struct fd_info {
@@ -0,0 +1,29 @@
+#ifndef _INIT_GRAPH_H
+#define _INIT_GRAPH_H
+
+struct module_data;
+
+/*
+ * things a stage can depend on. a stage starts as soon as everything it
+ * needs was provided by stages that finished successfully
+ */
+#define INIT_RES_BLOCK_INFO		(1 << 0)	// module_data.block_info
+#define INIT_RES_DEV_NODES		(1 << 1)	// PATH_MOUNTPOINT_DEV "/block"
+#define INIT_RES_BOOTLOADER		(1 << 2)	// PATH_MOUNTPOINT_BOOTLOADER
+#define INIT_RES_MULTIBOOT_FILES	(1 << 3)	// local copy in /multiboot
+#define INIT_RES_SOURCE			(1 << 4)	// PATH_MOUNTPOINT_SOURCE
+#define INIT_RES_MULTIBOOT_FSTAB	(1 << 5)	// module_data.multiboot_fstab
+#define INIT_RES_TARGET_FSTABS		(1 << 6)	// module_data.target_fstabs
+#define INIT_RES_EARLY_INIT		(1 << 7)	// modules' early_init
+
+struct init_stage {
+	const char *name;
+	int (*run) (struct module_data *data);
+	unsigned needs;
+	unsigned provides;
+};
+
+int init_graph_add(const struct init_stage *stage);
+int init_graph_add_stages(const struct init_stage *stages);
+int init_graph_run(struct module_data *data);
+#endif
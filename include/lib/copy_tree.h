@@ -0,0 +1,19 @@
+#ifndef _LIB_COPY_TREE_H_
+#define _LIB_COPY_TREE_H_
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+/*
+ * final mode for a subtree, path is relative to the copy target.
+ * applies to the entry itself and everything below it
+ */
+struct copy_tree_mode {
+	const char *path;
+	mode_t mode;
+};
+
+int copy_file(const char *source, const char *target, bool force);
+int copy_tree(const char *source, const char *target,
+	      const struct copy_tree_mode *modes, bool force);
+#endif
@@ -0,0 +1,45 @@
+#ifndef _LIB_FD_TABLE_H_
+#define _LIB_FD_TABLE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * fd -> data map for a traced process.
+ *
+ * Small fds are stored in a dense array, a bitmap tells if a fd is tracked
+ * at all. fds above FD_TABLE_DENSE go into a sorted overflow array.
+ */
+#define FD_TABLE_DENSE 256
+
+struct fd_table_overflow {
+	int fd;
+	bool cloexec;
+	void *data;
+};
+
+struct fd_table {
+	uint32_t tracked[FD_TABLE_DENSE / 32];
+	uint32_t cloexec[FD_TABLE_DENSE / 32];
+	void **dense;
+
+	struct fd_table_overflow *overflow;
+	int num_overflow;
+	int num_alloc;
+};
+
+typedef void (*fd_table_cb) (int fd, void *data, void *arg);
+typedef void *(*fd_table_copy_cb) (int fd, void *data, void *arg);
+
+void fd_table_init(struct fd_table *table);
+void fd_table_free(struct fd_table *table, fd_table_cb cb, void *arg);
+void fd_table_foreach(struct fd_table *table, fd_table_cb cb, void *arg);
+void *fd_table_get(struct fd_table *table, int fd);
+int fd_table_set(struct fd_table *table, int fd, void *data, bool cloexec);
+void *fd_table_remove(struct fd_table *table, int fd);
+void fd_table_set_cloexec(struct fd_table *table, int fd, bool cloexec);
+void fd_table_drop_cloexec(struct fd_table *table, fd_table_cb cb,
+			   void *arg);
+int fd_table_copy(struct fd_table *dst, struct fd_table *src,
+		  fd_table_copy_cb cb, fd_table_cb drop, void *arg);
+#endif
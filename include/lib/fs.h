@@ -4,8 +4,19 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+/* superblock state, from what a filesystem check would have to do */
+enum fs_state {
+	FS_STATE_UNKNOWN = -1,
+	FS_STATE_CLEAN,
+	// clean, but s_lastcheck was never set
+	FS_STATE_NEVER_CHECKED,
+	FS_STATE_NEEDS_CHECK,
+};
+
+int fs_check_state(const char *device, const char *fs_type);
 int fs_pre(struct fd_info *fdi);
 bool fs_was_format(struct fd_info *fdi);
 int fs_cleanup(struct fd_info *fdi);
+int fs_clone(struct fd_info *dst, struct fd_info *src);
 
 #endif
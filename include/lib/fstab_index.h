@@ -0,0 +1,36 @@
+#ifndef _LIB_FSTAB_INDEX_H_
+#define _LIB_FSTAB_INDEX_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+struct fstab_rec;
+
+struct fstab_index_entry {
+	struct fstab_rec *rec;
+	unsigned prio;
+	union {
+		dev_t dev;
+		const char *path;
+	} key;
+};
+
+/*
+ * open-addressing tables keyed by st_rdev and blk_device,
+ * slots with a NULL rec are free
+ */
+struct fstab_index {
+	struct fstab_index_entry *by_dev;
+	struct fstab_index_entry *by_path;
+	unsigned size;
+	unsigned count;
+};
+
+int fstab_index_init(struct fstab_index *index, unsigned max_recs);
+void fstab_index_free(struct fstab_index *index);
+unsigned fstab_index_add(struct fstab_index *index, struct fstab_rec *rec);
+void fstab_index_add_dev(struct fstab_index *index, struct fstab_rec *rec,
+			 unsigned prio);
+struct fstab_rec *fstab_index_lookup(struct fstab_index *index,
+				     const char *path, bool (*refresh) (void));
+#endif
@@ -0,0 +1,6 @@
+#ifndef _LIB_FSTYPE_CACHE_H_
+#define _LIB_FSTYPE_CACHE_H_
+
+const char *fstype_cache_get(const char *blk_device);
+void fstype_cache_report(void);
+#endif
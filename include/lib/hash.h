@@ -0,0 +1,54 @@
+#ifndef _LIB_HASH_H_
+#define _LIB_HASH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * FNV-1a, good enough for the small tables we use
+ */
+static inline uint32_t hash_string(const char *s)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*s) {
+		hash ^= (unsigned char)*s++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* 64bit FNV-1a over a buffer, for content fingerprints */
+static inline uint64_t hash_data(const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint64_t hash = 14695981039346656037ULL;
+
+	while (len--) {
+		hash ^= *p++;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static inline uint32_t hash_u64(uint64_t v)
+{
+	v ^= v >> 33;
+	v *= 0xff51afd7ed558ccdULL;
+	v ^= v >> 33;
+	return (uint32_t)v;
+}
+
+/* smallest power of two which is >= 2*n */
+static inline unsigned hash_table_size(unsigned n)
+{
+	unsigned size = 8;
+
+	while (size < 2 * n)
+		size <<= 1;
+
+	return size;
+}
+#endif
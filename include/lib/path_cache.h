@@ -0,0 +1,8 @@
+#ifndef _LIB_PATH_CACHE_H_
+#define _LIB_PATH_CACHE_H_
+
+const char *path_cache_lookup(const char *path);
+void path_cache_insert(const char *path, const char *resolved);
+void path_cache_flush(void);
+void path_cache_report(void);
+#endif
@@ -0,0 +1,25 @@
+#ifndef _LIB_PATH_TRIE_H_
+#define _LIB_PATH_TRIE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct path_trie_node {
+	char c;
+	bool terminal;
+	int child;
+	int next;
+};
+
+struct path_trie {
+	struct path_trie_node *nodes;
+	int num_nodes;
+	int num_alloc;
+};
+
+struct path_trie *path_trie_create(void);
+void path_trie_free(struct path_trie *trie);
+int path_trie_add(struct path_trie *trie, const char *prefix);
+bool path_trie_match(const struct path_trie *trie, const char *path,
+		     size_t len);
+#endif
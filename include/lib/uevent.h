@@ -15,18 +15,38 @@ struct sys_block_uevent {
 	uevent_type_t type;
 };
 
+enum {
+	UEVENT_INDEX_PARTNAME,
+	UEVENT_INDEX_DEVNAME,
+	UEVENT_INDEX_PART,
+	UEVENT_INDEX_DEV,
+	UEVENT_INDEX_MAX
+};
+
 struct sys_block_info {
 	int num_entries;
 	struct sys_block_uevent *entries;
+
+	// hash indices, slots hold entry index + 1
+	unsigned index_size;
+	int *index[UEVENT_INDEX_MAX];
 };
 
 struct sys_block_info *get_block_devices(void);
 void free_block_devices(struct sys_block_info *info);
+int uevent_build_index(struct sys_block_info *info);
 struct sys_block_uevent *get_blockinfo_for_path(struct sys_block_info *info,
 						const char *path);
+int uevent_path_supported(struct sys_block_info *info, const char *path);
+struct sys_block_uevent *get_blockinfo_for_dev(struct sys_block_info *info,
+					       dev_t dev);
 char *uevent_realpath(struct sys_block_info *info,
 		      const char *path, char *resolved_path);
 int uevent_stat(struct sys_block_info *info, const char *path,
 		struct stat *buf);
 int uevent_create_nodes(struct sys_block_info *info, const char *path);
+int uevent_listener_init(void);
+int uevent_listener_start(struct sys_block_info *info, const char *dev_path);
+unsigned uevent_listener_seq(void);
+int uevent_wait_for_device(const char *path, int timeout_ms);
 #endif
@@ -45,6 +45,9 @@ typedef int (*module_call_tracy_child_t) (struct module_data *,
 					  struct tracy_child *);
 
 struct module {
+	// extra early init stages, terminated by an entry without name
+	const struct init_stage *stages;
+
 	// nothing is mounted, but the main data is available
 	// we have private /dev already
 	module_call_t early_init;
@@ -60,6 +63,7 @@ struct module {
 };
 
 void module_register(struct module *module);
+int modules_add_stages(void);
 const char *strbootmode(bootmode_t bm);
 
 int modules_call_early_init(struct module_data *data);
@@ -0,0 +1,24 @@
+#ifndef _RC_PATCH_H
+#define _RC_PATCH_H
+
+#include <common.h>
+
+// pattern is a POSIX basic regex instead of a literal string
+#define RC_PATCH_REGEX 0x1
+
+/*
+ * replace every occurrence of 'pattern' in each line of 'file'.
+ * unlike sed, the replacement is inserted literally
+ */
+struct rc_patch_rule {
+	const char *file;
+	const char *pattern;
+	const char *replacement;
+	unsigned flags;
+};
+
+int rc_patch_add(const char *file, const char *pattern,
+		 const char *replacement, unsigned flags);
+int rc_patch_add_rules(const struct rc_patch_rule *rules);
+int rc_patch_apply(void);
+#endif
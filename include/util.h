@@ -12,19 +12,22 @@ char *make_loop(const char *path);
 size_t strlcpy(char *dst, const char *src, size_t dstsize);
 size_t strlcat(char *dst, const char *src, size_t dstsize);
 char *get_patharg(struct tracy_child *child, long addr, int real);
+int get_patharg_filtered(struct tracy_child *child, long addr, int real,
+			 const struct path_trie *filter, char **result);
 tracy_child_addr_t copy_patharg(struct tracy_child *child, const char *path);
 void free_patharg(struct tracy_child *child, tracy_child_addr_t addr);
+void scratch_invalidate(struct tracy_child *child);
 int do_exec(char **args);
 int createRawImage(const char *source, const char *target,
 		   unsigned long blocks);
+int setup_loop(const char *device, const char *file, uint64_t offset,
+	       uint64_t sizelimit, uint32_t lo_flags);
 int set_loop(char *device, char *file, int ro);
 int util_copy(char *source, char *target, bool recursive, bool force);
-int util_chmod(char *path, char *mode, bool recursive);
 int format_path(char *path);
 int make_ext4fs(char *path);
 int check_fs_nomount(char *path);
 int patch_vold(void);
-int sed_replace(const char *file, const char *regex);
 const char *get_fstype(const char *blk_device);
 
 typedef int (*check_string) (const char *);
@@ -0,0 +1,441 @@
+#include <common.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+
+#define COPY_TREE_MAX_THREADS 4
+#define COPY_CHUNK (16 * 1024 * 1024)
+#define COPY_BUF_SIZE (64 * 1024)
+
+struct copy_job {
+	struct copy_job *next;
+	// inherited from a parent directory, NULL if there's none
+	const struct copy_tree_mode *mode;
+	// relative to both roots
+	char path[];
+};
+
+struct copy_tree {
+	int srcfd;
+	int dstfd;
+	const struct copy_tree_mode *modes;
+	bool force;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct copy_job *jobs;
+	// number of workers currently copying a directory
+	int busy;
+
+	unsigned files;
+	unsigned errors;
+};
+
+// set once the kernel told us it doesn't have copy_file_range
+static bool no_copy_range;
+
+static long elapsed_us(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000L +
+	    (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+static bool copy_unsupported(int err)
+{
+	return err == ENOSYS || err == EXDEV || err == EINVAL ||
+	    err == EOPNOTSUPP;
+}
+
+/*
+ * copy everything from the current position of 'in' to 'out'.
+ * both file offsets advance, so each method continues where the
+ * previous one gave up
+ */
+static int copy_data(int in, int out)
+{
+	char *buf;
+	ssize_t n;
+
+#ifdef __NR_copy_file_range
+	if (!__atomic_load_n(&no_copy_range, __ATOMIC_RELAXED)) {
+		do {
+			n = syscall(__NR_copy_file_range, in, NULL, out, NULL,
+				    COPY_CHUNK, 0);
+		} while (n > 0 || (n < 0 && errno == EINTR));
+		if (n == 0)
+			return 0;
+		if (!copy_unsupported(errno))
+			return -1;
+		if (errno == ENOSYS)
+			__atomic_store_n(&no_copy_range, true,
+					 __ATOMIC_RELAXED);
+	}
+#endif
+
+	do {
+		n = sendfile(out, in, NULL, COPY_CHUNK);
+	} while (n > 0 || (n < 0 && errno == EINTR));
+	if (n == 0)
+		return 0;
+	if (!copy_unsupported(errno))
+		return -1;
+
+	buf = malloc(COPY_BUF_SIZE);
+	if (!buf)
+		return -1;
+
+	while ((n = read(in, buf, COPY_BUF_SIZE)) != 0) {
+		char *p = buf;
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		while (n > 0) {
+			ssize_t w = write(out, p, n);
+			if (w < 0) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			p += w;
+			n -= w;
+		}
+		if (n)
+			break;
+	}
+
+	free(buf);
+	return n ? -1 : 0;
+}
+
+/*
+ * copy a regular file. the target gets the source permissions
+ * unless 'mode' overrides them
+ */
+static int copy_file_at(int srcdir, const char *source, int dstdir,
+			const char *target, const struct stat *st,
+			const mode_t *mode, bool force)
+{
+	int in, out, rc;
+
+	in = openat(srcdir, source, O_RDONLY | O_CLOEXEC);
+	if (in < 0)
+		return -1;
+
+	out = openat(dstdir, target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		     st->st_mode & 07777);
+	// like `cp -f', replace targets we can't open
+	if (out < 0 && force && errno != ENOENT && !unlinkat(dstdir, target, 0))
+		out = openat(dstdir, target,
+			     O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			     st->st_mode & 07777);
+	if (out < 0) {
+		close(in);
+		return -1;
+	}
+
+	rc = copy_data(in, out);
+	if (!rc && mode)
+		rc = fchmod(out, *mode);
+
+	close(in);
+	if (close(out))
+		rc = -1;
+
+	return rc;
+}
+
+static int copy_link_at(int srcdir, int dstdir, const char *name, bool force)
+{
+	char buf[PATH_MAX];
+	ssize_t len;
+
+	len = readlinkat(srcdir, name, buf, sizeof(buf));
+	if (len < 0)
+		return -1;
+	if (len == sizeof(buf)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	buf[len] = '\0';
+
+	if (!symlinkat(buf, dstdir, name))
+		return 0;
+	if (errno != EEXIST || !force || unlinkat(dstdir, name, 0))
+		return -1;
+
+	return symlinkat(buf, dstdir, name);
+}
+
+static int copy_node_at(int dstdir, const char *name, const struct stat *st,
+			const mode_t *mode, bool force)
+{
+	mode_t perm = mode ? *mode : st->st_mode & 07777;
+
+	if (force && unlinkat(dstdir, name, 0) && errno != ENOENT)
+		return -1;
+
+	return mknodat(dstdir, name, (st->st_mode & S_IFMT) | perm,
+		       st->st_rdev);
+}
+
+static const struct copy_tree_mode *find_mode(struct copy_tree *ct,
+					      const char *path)
+{
+	const struct copy_tree_mode *m;
+
+	for (m = ct->modes; m && m->path; m++) {
+		if (!strcmp(m->path, path))
+			return m;
+	}
+
+	return NULL;
+}
+
+static void copy_error(struct copy_tree *ct, const char *path)
+{
+	ERROR("copy_tree: %s: %s\n", path, strerror(errno));
+	__atomic_add_fetch(&ct->errors, 1, __ATOMIC_RELAXED);
+}
+
+static int copy_tree_push(struct copy_tree *ct, const char *path,
+			  const struct copy_tree_mode *mode)
+{
+	size_t len = strlen(path) + 1;
+	struct copy_job *job;
+
+	job = malloc(sizeof(*job) + len);
+	if (!job)
+		return -1;
+	job->mode = mode;
+	memcpy(job->path, path, len);
+
+	pthread_mutex_lock(&ct->lock);
+	job->next = ct->jobs;
+	ct->jobs = job;
+	pthread_cond_signal(&ct->cond);
+	pthread_mutex_unlock(&ct->lock);
+
+	return 0;
+}
+
+static int copy_entry(struct copy_tree *ct, struct copy_job *job, int srcdir,
+		      int dstdir, const char *name, const char *path)
+{
+	const struct copy_tree_mode *mode;
+	struct stat st;
+
+	if (fstatat(srcdir, name, &st, AT_SYMLINK_NOFOLLOW))
+		return -1;
+
+	mode = job->mode ? job->mode : find_mode(ct, path);
+
+	switch (st.st_mode & S_IFMT) {
+	case S_IFDIR:
+		if (mkdirat(dstdir, name, mode ? mode->mode : st.st_mode & 07777)
+		    && errno != EEXIST)
+			return -1;
+		// an existing directory keeps its mode unless we override it
+		if (mode && fchmodat(dstdir, name, mode->mode, 0))
+			return -1;
+		return copy_tree_push(ct, path, mode);
+
+	case S_IFREG:
+		if (copy_file_at(srcdir, name, dstdir, name, &st,
+				 mode ? &mode->mode : NULL, ct->force))
+			return -1;
+		__atomic_add_fetch(&ct->files, 1, __ATOMIC_RELAXED);
+		return 0;
+
+	case S_IFLNK:
+		return copy_link_at(srcdir, dstdir, name, ct->force);
+
+	default:
+		return copy_node_at(dstdir, name, &st,
+				    mode ? &mode->mode : NULL, ct->force);
+	}
+}
+
+static void copy_dir(struct copy_tree *ct, struct copy_job *job)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	int srcdir, dstdir;
+	DIR *dir;
+
+	srcdir = openat(ct->srcfd, job->path,
+			O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (srcdir < 0) {
+		copy_error(ct, job->path);
+		return;
+	}
+
+	dstdir = openat(ct->dstfd, job->path,
+			O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dstdir < 0) {
+		copy_error(ct, job->path);
+		close(srcdir);
+		return;
+	}
+
+	dir = fdopendir(srcdir);
+	if (!dir) {
+		copy_error(ct, job->path);
+		close(srcdir);
+		close(dstdir);
+		return;
+	}
+
+	while ((de = readdir(dir))) {
+		int len;
+
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+
+		if (!strcmp(job->path, "."))
+			len = snprintf(path, sizeof(path), "%s", de->d_name);
+		else
+			len = snprintf(path, sizeof(path), "%s/%s", job->path,
+				       de->d_name);
+		if (len >= (int)sizeof(path)) {
+			errno = ENAMETOOLONG;
+			copy_error(ct, job->path);
+			continue;
+		}
+
+		if (copy_entry(ct, job, srcdir, dstdir, de->d_name, path))
+			copy_error(ct, path);
+	}
+
+	closedir(dir);
+	close(dstdir);
+}
+
+static void *copy_tree_worker(void *arg)
+{
+	struct copy_tree *ct = arg;
+	struct copy_job *job;
+
+	pthread_mutex_lock(&ct->lock);
+	for (;;) {
+		// other workers may still find subdirectories
+		while (!ct->jobs && ct->busy)
+			pthread_cond_wait(&ct->cond, &ct->lock);
+
+		job = ct->jobs;
+		if (!job)
+			break;
+		ct->jobs = job->next;
+		ct->busy++;
+		pthread_mutex_unlock(&ct->lock);
+
+		copy_dir(ct, job);
+		free(job);
+
+		pthread_mutex_lock(&ct->lock);
+		ct->busy--;
+		if (!ct->busy && !ct->jobs)
+			pthread_cond_broadcast(&ct->cond);
+	}
+	pthread_mutex_unlock(&ct->lock);
+
+	return NULL;
+}
+
+int copy_file(const char *source, const char *target, bool force)
+{
+	struct stat st;
+
+	if (stat(source, &st))
+		return -1;
+	if (S_ISDIR(st.st_mode)) {
+		errno = EISDIR;
+		return -1;
+	}
+
+	return copy_file_at(AT_FDCWD, source, AT_FDCWD, target, &st, NULL,
+			    force);
+}
+
+/*
+ * copy a directory tree like `cp -R', merging into 'target' if it exists.
+ * directories are handed out to a few threads, file modes are taken from
+ * 'modes' (terminated by a NULL path) where given and from the source
+ * otherwise
+ */
+int copy_tree(const char *source, const char *target,
+	      const struct copy_tree_mode *modes, bool force)
+{
+	pthread_t threads[COPY_TREE_MAX_THREADS];
+	struct copy_tree ct = {
+		.modes = modes,
+		.force = force,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+	};
+	struct timespec start;
+	struct stat st;
+	int nthreads, num_started = 0;
+	long cpus;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	ct.srcfd = open(source, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (ct.srcfd < 0)
+		return -1;
+
+	if (fstat(ct.srcfd, &st) ||
+	    (mkdir(target, st.st_mode & 07777) && errno != EEXIST)) {
+		close(ct.srcfd);
+		return -1;
+	}
+
+	ct.dstfd = open(target, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (ct.dstfd < 0) {
+		close(ct.srcfd);
+		return -1;
+	}
+
+	if (copy_tree_push(&ct, ".", NULL)) {
+		close(ct.srcfd);
+		close(ct.dstfd);
+		return -1;
+	}
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = cpus > 0 ? cpus : 1;
+	if (nthreads > COPY_TREE_MAX_THREADS)
+		nthreads = COPY_TREE_MAX_THREADS;
+
+	// the calling thread is a worker too
+	for (i = 1; i < nthreads; i++) {
+		if (pthread_create(&threads[num_started], NULL,
+				   copy_tree_worker, &ct))
+			break;
+		num_started++;
+	}
+	copy_tree_worker(&ct);
+	for (i = 0; i < num_started; i++)
+		pthread_join(threads[i], NULL);
+
+	close(ct.srcfd);
+	close(ct.dstfd);
+
+	INFO("%s: %s: %u files in %ldus using %d threads\n", __func__, target,
+	     ct.files, elapsed_us(&start), num_started + 1);
+
+	if (ct.errors) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,271 @@
+#include <common.h>
+
+#define BIT_WORD(fd) ((unsigned)(fd) >> 5)
+#define BIT_MASK(fd) (1u << ((unsigned)(fd) & 31))
+
+static bool is_dense(int fd)
+{
+	return fd >= 0 && fd < FD_TABLE_DENSE;
+}
+
+static bool test_bit(const uint32_t *map, int fd)
+{
+	return (map[BIT_WORD(fd)] & BIT_MASK(fd)) != 0;
+}
+
+static void assign_bit(uint32_t *map, int fd, bool val)
+{
+	if (val)
+		map[BIT_WORD(fd)] |= BIT_MASK(fd);
+	else
+		map[BIT_WORD(fd)] &= ~BIT_MASK(fd);
+}
+
+/*
+ * returns the index of fd or the position where it has to be inserted
+ */
+static int overflow_find(struct fd_table *table, int fd, bool *found)
+{
+	int lo = 0, hi = table->num_overflow;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (table->overflow[mid].fd < fd)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*found = lo < table->num_overflow && table->overflow[lo].fd == fd;
+	return lo;
+}
+
+void fd_table_init(struct fd_table *table)
+{
+	memset(table, 0, sizeof(table[0]));
+}
+
+void *fd_table_get(struct fd_table *table, int fd)
+{
+	bool found;
+	int i;
+
+	if (is_dense(fd))
+		return test_bit(table->tracked, fd) ? table->dense[fd] : NULL;
+
+	if (!table->num_overflow)
+		return NULL;
+
+	i = overflow_find(table, fd, &found);
+	return found ? table->overflow[i].data : NULL;
+}
+
+int fd_table_set(struct fd_table *table, int fd, void *data, bool cloexec)
+{
+	bool found;
+	int i;
+
+	if (fd < 0)
+		return -1;
+
+	if (is_dense(fd)) {
+		if (!table->dense) {
+			table->dense =
+			    calloc(FD_TABLE_DENSE, sizeof(table->dense[0]));
+			if (!table->dense)
+				return -1;
+		}
+
+		table->dense[fd] = data;
+		assign_bit(table->tracked, fd, true);
+		assign_bit(table->cloexec, fd, cloexec);
+		return 0;
+	}
+
+	i = overflow_find(table, fd, &found);
+	if (!found) {
+		if (table->num_overflow == table->num_alloc) {
+			int num_alloc =
+			    table->num_alloc ? table->num_alloc * 2 : 8;
+			struct fd_table_overflow *overflow =
+			    realloc(table->overflow,
+				    num_alloc * sizeof(overflow[0]));
+			if (!overflow)
+				return -1;
+
+			table->overflow = overflow;
+			table->num_alloc = num_alloc;
+		}
+
+		memmove(&table->overflow[i + 1], &table->overflow[i],
+			(table->num_overflow - i) * sizeof(table->overflow[0]));
+		table->num_overflow++;
+		table->overflow[i].fd = fd;
+	}
+
+	table->overflow[i].data = data;
+	table->overflow[i].cloexec = cloexec;
+	return 0;
+}
+
+void *fd_table_remove(struct fd_table *table, int fd)
+{
+	void *data;
+	bool found;
+	int i;
+
+	if (is_dense(fd)) {
+		if (!test_bit(table->tracked, fd))
+			return NULL;
+
+		data = table->dense[fd];
+		table->dense[fd] = NULL;
+		assign_bit(table->tracked, fd, false);
+		assign_bit(table->cloexec, fd, false);
+		return data;
+	}
+
+	if (!table->num_overflow)
+		return NULL;
+
+	i = overflow_find(table, fd, &found);
+	if (!found)
+		return NULL;
+
+	data = table->overflow[i].data;
+	table->num_overflow--;
+	memmove(&table->overflow[i], &table->overflow[i + 1],
+		(table->num_overflow - i) * sizeof(table->overflow[0]));
+	return data;
+}
+
+void fd_table_set_cloexec(struct fd_table *table, int fd, bool cloexec)
+{
+	bool found;
+	int i;
+
+	if (is_dense(fd)) {
+		if (test_bit(table->tracked, fd))
+			assign_bit(table->cloexec, fd, cloexec);
+		return;
+	}
+
+	i = overflow_find(table, fd, &found);
+	if (found)
+		table->overflow[i].cloexec = cloexec;
+}
+
+/*
+ * remove all fds which would get closed by execve
+ */
+void fd_table_drop_cloexec(struct fd_table *table, fd_table_cb cb, void *arg)
+{
+	unsigned w;
+	int i, j;
+
+	for (w = 0; w < ARRAY_SIZE(table->cloexec); w++) {
+		uint32_t bits = table->cloexec[w];
+
+		while (bits) {
+			int fd = w * 32 + __builtin_ctz(bits);
+			void *data = fd_table_remove(table, fd);
+
+			bits &= bits - 1;
+			if (cb)
+				cb(fd, data, arg);
+		}
+	}
+
+	for (i = 0, j = 0; i < table->num_overflow; i++) {
+		if (table->overflow[i].cloexec) {
+			if (cb)
+				cb(table->overflow[i].fd,
+				   table->overflow[i].data, arg);
+		} else
+			table->overflow[j++] = table->overflow[i];
+	}
+	table->num_overflow = j;
+}
+
+/*
+ * copy the entries of 'src' which 'dst' doesn't track yet, so 'dst' keeps
+ * its newer ones. cb has to duplicate the data, returning NULL skips the
+ * entry. a copy which can't be stored is passed to drop and -1 is returned
+ */
+int fd_table_copy(struct fd_table *dst, struct fd_table *src,
+		  fd_table_copy_cb cb, fd_table_cb drop, void *arg)
+{
+	unsigned w;
+	int i;
+
+	for (w = 0; w < ARRAY_SIZE(src->tracked); w++) {
+		uint32_t bits = src->tracked[w] & ~dst->tracked[w];
+
+		while (bits) {
+			int fd = w * 32 + __builtin_ctz(bits);
+			void *data = cb(fd, src->dense[fd], arg);
+
+			bits &= bits - 1;
+			if (!data)
+				continue;
+			if (fd_table_set(dst, fd, data,
+					 test_bit(src->cloexec, fd))) {
+				drop(fd, data, arg);
+				return -1;
+			}
+		}
+	}
+
+	for (i = 0; i < src->num_overflow; i++) {
+		struct fd_table_overflow *o = &src->overflow[i];
+		bool found;
+		void *data;
+
+		if (dst->num_overflow) {
+			overflow_find(dst, o->fd, &found);
+			if (found)
+				continue;
+		}
+
+		data = cb(o->fd, o->data, arg);
+		if (!data)
+			continue;
+		if (fd_table_set(dst, o->fd, data, o->cloexec)) {
+			drop(o->fd, data, arg);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void fd_table_foreach(struct fd_table *table, fd_table_cb cb, void *arg)
+{
+	unsigned w;
+	int i;
+
+	for (w = 0; w < ARRAY_SIZE(table->tracked); w++) {
+		uint32_t bits = table->tracked[w];
+
+		while (bits) {
+			int fd = w * 32 + __builtin_ctz(bits);
+
+			bits &= bits - 1;
+			cb(fd, table->dense[fd], arg);
+		}
+	}
+
+	for (i = 0; i < table->num_overflow; i++)
+		cb(table->overflow[i].fd, table->overflow[i].data, arg);
+}
+
+void fd_table_free(struct fd_table *table, fd_table_cb cb, void *arg)
+{
+	if (cb)
+		fd_table_foreach(table, cb, arg);
+
+	free(table->dense);
+	free(table->overflow);
+	fd_table_init(table);
+}
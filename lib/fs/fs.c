@@ -3,6 +3,17 @@
 extern int ext2_pre(struct fd_info *fdi);
 extern bool ext2_was_format(struct fd_info *fdi);
 extern int ext2_cleanup(struct fd_info *fdi);
+extern int ext2_clone(struct fd_info *dst, struct fd_info *src);
+extern int ext2_check_state(const char *device);
+
+int fs_check_state(const char *device, const char *fs_type)
+{
+	if (!strcmp(fs_type, "ext2") || !strcmp(fs_type, "ext3")
+	    || !strcmp(fs_type, "ext4"))
+		return ext2_check_state(device);
+
+	return FS_STATE_UNKNOWN;
+}
 
 int fs_pre(struct fd_info *fdi)
 {
@@ -41,3 +52,17 @@ int fs_cleanup(struct fd_info *fdi)
 	ERROR("%s: unhandled fstype %s\n", __func__, fdi->fs_type);
 	return 0;
 }
+
+int fs_clone(struct fd_info *dst, struct fd_info *src)
+{
+	dst->fs_pdata = NULL;
+
+	if (!src->fs_type)
+		return 0;
+
+	if (!strcmp(src->fs_type, "ext4"))
+		return ext2_clone(dst, src);
+
+	ERROR("%s: unhandled fstype %s\n", __func__, src->fs_type);
+	return 0;
+}
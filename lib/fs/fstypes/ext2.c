@@ -1,4 +1,5 @@
 #include <common.h>
+#include <time.h>
 
 struct ext2_super_block {
 	uint32_t s_inodes_count;
@@ -8,7 +9,9 @@ struct ext2_super_block {
 	uint32_t s_free_inodes_count;
 	uint32_t s_first_data_block;
 	uint32_t s_log_block_size;
-	uint32_t s_dummy3[7];
+	uint32_t s_dummy3[6];
+	uint16_t s_mnt_count;
+	int16_t s_max_mnt_count;
 	unsigned char s_magic[2];
 	uint16_t s_state;
 	uint16_t s_errors;
@@ -66,6 +69,12 @@ struct ext2_super_block {
 /* magic string offset within super block */
 #define EXT_MAG_OFF				0x38
 
+/* s_state */
+#define EXT2_VALID_FS				0x0001
+#define EXT2_ERROR_FS				0x0002
+/* s_feature_incompat */
+#define EXT3_FEATURE_INCOMPAT_RECOVER		0x0004
+
 struct ext2_pdata {
 	struct ext2_super_block sb_pre;
 };
@@ -138,3 +147,55 @@ int ext2_cleanup(struct fd_info *fdi)
 
 	return true;
 }
+
+int ext2_clone(struct fd_info *dst, struct fd_info *src)
+{
+	if (!src->fs_pdata)
+		return 0;
+
+	dst->fs_pdata = malloc(sizeof(struct ext2_pdata));
+	if (!dst->fs_pdata)
+		return -1;
+
+	memcpy(dst->fs_pdata, src->fs_pdata, sizeof(struct ext2_pdata));
+	return 0;
+}
+
+/*
+ * decide like e2fsck would if a check without -f has anything to do
+ */
+int ext2_check_state(const char *device)
+{
+	struct ext2_super_block sb;
+	uint32_t now = time(NULL);
+	ssize_t n;
+	int fd;
+
+	fd = open(device, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return FS_STATE_UNKNOWN;
+	n = pread(fd, &sb, sizeof(sb), EXT_SB_OFF);
+	close(fd);
+
+	if (n != sizeof(sb) || memcmp(sb.s_magic, EXT_SB_MAGIC, 2))
+		return FS_STATE_UNKNOWN;
+
+	if (!(sb.s_state & EXT2_VALID_FS) || (sb.s_state & EXT2_ERROR_FS))
+		return FS_STATE_NEEDS_CHECK;
+
+	// the journal has to be replayed or orphans have to be released
+	if ((sb.s_feature_incompat & EXT3_FEATURE_INCOMPAT_RECOVER)
+	    || sb.s_last_orphan)
+		return FS_STATE_NEEDS_CHECK;
+
+	if (sb.s_max_mnt_count > 0 && sb.s_mnt_count >= sb.s_max_mnt_count)
+		return FS_STATE_NEEDS_CHECK;
+
+	if (sb.s_checkinterval && now >= sb.s_lastcheck + sb.s_checkinterval)
+		return FS_STATE_NEEDS_CHECK;
+
+	if (!sb.s_lastcheck)
+		return FS_STATE_NEVER_CHECKED;
+
+	return FS_STATE_CLEAN;
+}
@@ -114,10 +114,18 @@ static int wait_for_file(const char *filename, int timeout)
 {
 	struct stat info;
 	time_t timeout_time = gettime() + timeout;
-	int ret = -1;
+	int ret;
 
-	while (gettime() < timeout_time && ((ret = stat(filename, &info)) < 0))
-		usleep(10000);
+	/* Wake up as soon as the kernel announces the device, but never check
+	 * less often than every 10ms. Not every path can be matched to a
+	 * uevent and the node may show up without us noticing.
+	 */
+	while ((ret = stat(filename, &info)) < 0 && gettime() < timeout_time) {
+		if (!uevent_wait_for_device(filename, 10))
+			usleep(1000);	/* the node gets created right after */
+		else if (errno != ETIMEDOUT)
+			usleep(10000);
+	}
 
 	return ret;
 }
@@ -473,6 +481,17 @@ void check_fs(char *blk_device, char *fs_type, char *target)
 	/* Check for the types of filesystems we know how to check */
 	if (!strcmp(fs_type, "ext2") || !strcmp(fs_type, "ext3")
 	    || !strcmp(fs_type, "ext4")) {
+		/*
+		 * e2fsck without -f only checks what the superblock asks for.
+		 * Ask it ourselves and save the trial mount and the fork.
+		 */
+		ret = fs_check_state(blk_device, fs_type);
+		if (ret == FS_STATE_CLEAN || ret == FS_STATE_NEVER_CHECKED) {
+			INFO("%s is clean, skipping %s\n", blk_device,
+			     E2FSCK_BIN);
+			return;
+		}
+
 		/*
 		 * First try to mount and unmount the filesystem.  We do this because
 		 * the kernel is more efficient than e2fsck in running the journal and
@@ -0,0 +1,371 @@
+#include <common.h>
+
+/*
+ * lookup index for redirectable fstab records
+ *
+ * Records get a priority in the order they are added, which is the order
+ * a linear scan would check them. Each record is keyed by its st_rdev and
+ * its blk_device path, a lookup checks both tables and returns the match
+ * with the lower priority value.
+ */
+
+int fstab_index_init(struct fstab_index *index, unsigned max_recs)
+{
+	memset(index, 0, sizeof(index[0]));
+
+	index->size = hash_table_size(max_recs);
+	index->by_dev = calloc(index->size, sizeof(index->by_dev[0]));
+	index->by_path = calloc(index->size, sizeof(index->by_path[0]));
+	if (!index->by_dev || !index->by_path) {
+		fstab_index_free(index);
+		return -1;
+	}
+
+	return 0;
+}
+
+void fstab_index_free(struct fstab_index *index)
+{
+	free(index->by_dev);
+	free(index->by_path);
+	memset(index, 0, sizeof(index[0]));
+}
+
+void fstab_index_add_dev(struct fstab_index *index, struct fstab_rec *rec,
+			 unsigned prio)
+{
+	unsigned mask = index->size - 1;
+	unsigned i;
+
+	i = hash_u64(rec->statbuf.st_rdev) & mask;
+	while (index->by_dev[i].rec) {
+		if (index->by_dev[i].key.dev == rec->statbuf.st_rdev)
+			return;
+		i = (i + 1) & mask;
+	}
+	index->by_dev[i].rec = rec;
+	index->by_dev[i].prio = prio;
+	index->by_dev[i].key.dev = rec->statbuf.st_rdev;
+}
+
+/*
+ * returns the priority of the record. records without a valid st_rdev
+ * only get keyed by path, see fstab_index_add_dev()
+ */
+unsigned fstab_index_add(struct fstab_index *index, struct fstab_rec *rec)
+{
+	unsigned mask = index->size - 1;
+	unsigned prio = index->count++;
+	unsigned i;
+
+	if (rec->blk_device) {
+		i = hash_string(rec->blk_device) & mask;
+		while (index->by_path[i].rec) {
+			// keep the entry with the higher priority
+			if (!strcmp(index->by_path[i].key.path,
+				    rec->blk_device))
+				goto add_dev;
+			i = (i + 1) & mask;
+		}
+		index->by_path[i].rec = rec;
+		index->by_path[i].prio = prio;
+		index->by_path[i].key.path = rec->blk_device;
+	}
+
+add_dev:
+	if (rec->statbuf.st_rdev)
+		fstab_index_add_dev(index, rec, prio);
+
+	return prio;
+}
+
+static struct fstab_index_entry *find_path(struct fstab_index *index,
+					   const char *path)
+{
+	unsigned mask = index->size - 1;
+	unsigned i = hash_string(path) & mask;
+
+	while (index->by_path[i].rec) {
+		if (!strcmp(index->by_path[i].key.path, path))
+			return &index->by_path[i];
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
+static struct fstab_index_entry *find_dev(struct fstab_index *index,
+					  dev_t dev)
+{
+	unsigned mask = index->size - 1;
+	unsigned i = hash_u64(dev) & mask;
+
+	while (index->by_dev[i].rec) {
+		if (index->by_dev[i].key.dev == dev)
+			return &index->by_dev[i];
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
+/*
+ * the record a linear scan would have found first. 'path' only gets
+ * stat()ed if it doesn't name the first record. if its device isn't
+ * indexed and 'refresh' returns true, the device gets looked up again
+ */
+struct fstab_rec *fstab_index_lookup(struct fstab_index *index,
+				     const char *path, bool (*refresh) (void))
+{
+	struct fstab_index_entry *match, *dev_match = NULL;
+	struct stat sb;
+
+	match = find_path(index, path);
+
+	// a path match with the highest priority can't be beaten
+	if (!match || match->prio) {
+		if (!stat(path, &sb) && sb.st_rdev) {
+			dev_match = find_dev(index, sb.st_rdev);
+			if (!dev_match && refresh && refresh())
+				dev_match = find_dev(index, sb.st_rdev);
+		}
+
+		if (dev_match && (!match || dev_match->prio < match->prio))
+			match = dev_match;
+	}
+
+	return match ? match->rec : NULL;
+}
+
+#ifdef TEST_PROGRAM
+#include <time.h>
+
+/*
+ * replays a path trace through the linear scan get_fstab_rec() used to do
+ * and through the index, checks that both agree and times them.
+ *
+ * a trace is one path per line, e.g. the paths hook_fileaccess saw during
+ * a boot. without one a built-in sample of a recovery boot is used. the
+ * records are taken from the block devices of the machine we run on, so
+ * st_rdev matches work for real device nodes in the trace.
+ */
+
+#define MAX_TEST_RECS 64
+
+static const char *sample_trace[] = {
+	"/dev/block/platform/msm_sdcc.1/by-name/system",
+	"/dev/block/platform/msm_sdcc.1/by-name/userdata",
+	"/dev/block/platform/msm_sdcc.1/by-name/cache",
+	"/dev/block/mmcblk0p25",
+	"/dev/block/mmcblk0p28",
+	"/dev/block/mmcblk1p1",
+	"/dev/block/loop0",
+	"/dev/null",
+	"/dev/urandom",
+	"/dev/__properties__",
+	"/system/build.prop",
+	"/system/lib/libc.so",
+	"/system/bin/linker",
+	"/sbin/recovery",
+	"/etc/recovery.fstab",
+	"/tmp/recovery.log",
+	"/proc/mounts",
+	"/proc/self/stat",
+	"/sys/class/power_supply/battery/capacity",
+	"/res/images/curtain.jpg",
+};
+
+static struct fstab_rec recs[MAX_TEST_RECS];
+static int num_recs;
+
+static char **trace;
+static size_t trace_len;
+
+// the old get_fstab_rec(), including its matches of st_rdev 0
+static struct fstab_rec *linear_lookup(const char *path)
+{
+	struct stat sb;
+	bool use_stat = !stat(path, &sb);
+	int i;
+
+	for (i = 0; i < num_recs; i++) {
+		if (use_stat && sb.st_rdev == recs[i].statbuf.st_rdev)
+			return &recs[i];
+		if (!strcmp(path, recs[i].blk_device))
+			return &recs[i];
+	}
+
+	return NULL;
+}
+
+static int add_rec(const char *path)
+{
+	struct fstab_rec *rec;
+
+	if (num_recs == MAX_TEST_RECS)
+		return -1;
+
+	rec = &recs[num_recs];
+	rec->blk_device = strdup(path);
+	if (!rec->blk_device)
+		return -1;
+	if (stat(path, &rec->statbuf) || !S_ISBLK(rec->statbuf.st_mode))
+		memset(&rec->statbuf, 0, sizeof(rec->statbuf));
+	// the linear scan would match regular files against these
+	if (!rec->statbuf.st_rdev)
+		rec->statbuf.st_rdev = makedev(0xfff, num_recs);
+
+	num_recs++;
+	return 0;
+}
+
+static int load_recs(void)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	DIR *dir;
+	size_t i;
+
+	// the sample block devices first, like the multiboot source
+	for (i = 0; i < 6; i++)
+		if (add_rec(sample_trace[i]))
+			return -1;
+
+	dir = opendir("/dev");
+	if (!dir)
+		return 0;
+	while ((de = readdir(dir)) && num_recs < MAX_TEST_RECS) {
+		if (strncmp(de->d_name, "sd", 2) && strncmp(de->d_name, "vd", 2)
+		    && strncmp(de->d_name, "nvme", 4)
+		    && strncmp(de->d_name, "loop", 4))
+			continue;
+		snprintf(path, sizeof(path), "/dev/%s", de->d_name);
+		if (add_rec(path))
+			break;
+	}
+	closedir(dir);
+
+	return 0;
+}
+
+static int load_trace(const char *file)
+{
+	char line[PATH_MAX];
+	size_t alloc = 0;
+	FILE *f;
+
+	if (!file) {
+		trace = (char **)sample_trace;
+		trace_len = ARRAY_SIZE(sample_trace);
+		return 0;
+	}
+
+	f = fopen(file, "r");
+	if (!f)
+		return -1;
+
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = '\0';
+		if (!*line)
+			continue;
+
+		if (trace_len == alloc) {
+			char **tmp;
+
+			alloc = alloc ? alloc * 2 : 256;
+			tmp = realloc(trace, alloc * sizeof(trace[0]));
+			if (!tmp) {
+				fclose(f);
+				return -1;
+			}
+			trace = tmp;
+		}
+		trace[trace_len] = strdup(line);
+		if (!trace[trace_len]) {
+			fclose(f);
+			return -1;
+		}
+		trace_len++;
+	}
+	fclose(f);
+
+	return trace_len ? 0 : -1;
+}
+
+static long run(struct fstab_rec *(*lookup) (const char *), int loops,
+		size_t *hits)
+{
+	struct timespec start, end;
+	size_t i;
+	int l;
+
+	*hits = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (l = 0; l < loops; l++) {
+		for (i = 0; i < trace_len; i++) {
+			if (lookup(trace[i]))
+				(*hits)++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start.tv_sec) * 1000000L +
+	    (end.tv_nsec - start.tv_nsec) / 1000;
+}
+
+static struct fstab_index test_index;
+
+static struct fstab_rec *index_lookup(const char *path)
+{
+	return fstab_index_lookup(&test_index, path, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	int loops = argc > 2 ? atoi(argv[2]) : 1000;
+	size_t i, linear_hits, index_hits;
+	long linear_us, index_us;
+	int errors = 0;
+
+	if (argc > 1 && !strcmp(argv[1], "--help")) {
+		printf("usage: %s [<trace>|-] [<loops>]\n", argv[0]);
+		return EXIT_SUCCESS;
+	}
+
+	if (load_recs() || load_trace(argc > 1 && strcmp(argv[1], "-") ?
+				      argv[1] : NULL)) {
+		fprintf(stderr, "can't load records or trace\n");
+		return EXIT_FAILURE;
+	}
+
+	if (fstab_index_init(&test_index, num_recs))
+		return EXIT_FAILURE;
+	for (i = 0; i < (size_t)num_recs; i++)
+		fstab_index_add(&test_index, &recs[i]);
+
+	for (i = 0; i < trace_len; i++) {
+		struct fstab_rec *a = linear_lookup(trace[i]);
+		struct fstab_rec *b = index_lookup(trace[i]);
+
+		if (a != b) {
+			printf("MISMATCH %s: linear=%s index=%s\n", trace[i],
+			       a ? a->blk_device : "-",
+			       b ? b->blk_device : "-");
+			errors++;
+		}
+	}
+
+	linear_us = run(linear_lookup, loops, &linear_hits);
+	index_us = run(index_lookup, loops, &index_hits);
+
+	printf("%d records, %zu paths x %d\n", num_recs, trace_len, loops);
+	printf("linear: %8ldus %6.0fns/lookup %zu hits\n", linear_us,
+	       linear_us * 1000.0 / (trace_len * loops), linear_hits);
+	printf("index:  %8ldus %6.0fns/lookup %zu hits\n", index_us,
+	       index_us * 1000.0 / (trace_len * loops), index_hits);
+
+	fstab_index_free(&test_index);
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif /* TEST_PROGRAM */
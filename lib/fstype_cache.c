@@ -0,0 +1,176 @@
+#include <common.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+/*
+ * Filesystem type cache for get_fstype().
+ *
+ * Entries are keyed by the device (st_rdev, or st_dev/st_ino for images)
+ * and its size, and validated by a fingerprint of the first 4KiB, which
+ * holds the superblock of all filesystems we care about. A hit costs one
+ * read instead of a full libblkid probe. mkfs always rewrites that area,
+ * so reformatting a partition invalidates its entry.
+ *
+ * Returned types are interned and stay valid forever.
+ */
+
+#define FSTYPE_CACHE_ENTRIES 32
+#define FSTYPE_CACHE_FP_SIZE 4096
+#define FSTYPE_CACHE_REPORT_INTERVAL 256
+
+struct fstype_cache_entry {
+	bool used;
+	dev_t dev;
+	ino_t ino;
+	uint64_t size;
+	uint64_t fingerprint;
+	const char *type;
+	unsigned long last_used;
+};
+
+static struct fstype_cache_entry entries[FSTYPE_CACHE_ENTRIES];
+
+static char **interned = NULL;
+static unsigned num_interned = 0;
+
+static unsigned long tick = 0;
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+
+static const char *intern(const char *type)
+{
+	char **tmp;
+	unsigned i;
+
+	for (i = 0; i < num_interned; i++)
+		if (!strcmp(interned[i], type))
+			return interned[i];
+
+	tmp = realloc(interned, (num_interned + 1) * sizeof(*interned));
+	if (!tmp)
+		return NULL;
+	interned = tmp;
+
+	interned[num_interned] = strdup(type);
+	if (!interned[num_interned])
+		return NULL;
+
+	return interned[num_interned++];
+}
+
+void fstype_cache_report(void)
+{
+	INFO("fstype_cache: hits=%lu misses=%lu types=%u\n", hits, misses,
+	     num_interned);
+}
+
+static int get_device_size(int fd, const struct stat *sb, uint64_t * size)
+{
+	if (S_ISBLK(sb->st_mode))
+		return ioctl(fd, BLKGETSIZE64, size);
+
+	*size = sb->st_size;
+	return 0;
+}
+
+static const char *probe_fstype(int fd, const char *blk_device)
+{
+	const char *type, *result = NULL;
+	blkid_probe pr;
+
+	pr = blkid_new_probe();
+	if (!pr || blkid_probe_set_device(pr, fd, 0, 0)
+	    || blkid_do_typeprobe(pr)) {
+		ERROR("Can't probe device %s\n", blk_device);
+		goto out;
+	}
+
+	if (blkid_probe_lookup_value(pr, "TYPE", &type, NULL) < 0) {
+		ERROR("can't find filesystem on device %s\n", blk_device);
+		goto out;
+	}
+
+	// the value lives in the probe, which is gone after this
+	result = intern(type);
+
+out:
+	blkid_free_probe(pr);
+	return result;
+}
+
+const char *fstype_cache_get(const char *blk_device)
+{
+	struct fstype_cache_entry *entry = NULL, *oldest = &entries[0];
+	char buf[FSTYPE_CACHE_FP_SIZE];
+	uint64_t size, fingerprint;
+	struct stat sb;
+	dev_t dev;
+	ino_t ino;
+	ssize_t len;
+	unsigned i;
+	int fd;
+
+	fd = open(blk_device, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		ERROR("Can't probe device %s\n", blk_device);
+		return NULL;
+	}
+
+	if (fstat(fd, &sb) || get_device_size(fd, &sb, &size)) {
+		ERROR("Can't probe device %s\n", blk_device);
+		close(fd);
+		return NULL;
+	}
+
+	if (S_ISBLK(sb.st_mode) || S_ISCHR(sb.st_mode)) {
+		dev = sb.st_rdev;
+		ino = 0;
+	} else {
+		dev = sb.st_dev;
+		ino = sb.st_ino;
+	}
+
+	len = pread(fd, buf, sizeof(buf), 0);
+	fingerprint = hash_data(buf, len > 0 ? (size_t)len : 0);
+
+	if (++tick % FSTYPE_CACHE_REPORT_INTERVAL == 0)
+		fstype_cache_report();
+
+	for (i = 0; i < FSTYPE_CACHE_ENTRIES; i++) {
+		struct fstype_cache_entry *e = &entries[i];
+
+		if (!e->used) {
+			if (oldest->used)
+				oldest = e;
+			continue;
+		}
+		if (e->dev == dev && e->ino == ino) {
+			entry = e;
+			break;
+		}
+		if (oldest->used && e->last_used < oldest->last_used)
+			oldest = e;
+	}
+
+	if (entry && entry->size == size && entry->fingerprint == fingerprint) {
+		hits++;
+		entry->last_used = tick;
+		close(fd);
+		return entry->type;
+	}
+
+	misses++;
+	if (!entry)
+		entry = oldest;
+
+	entry->used = true;
+	entry->dev = dev;
+	entry->ino = ino;
+	entry->size = size;
+	entry->fingerprint = fingerprint;
+	entry->type = probe_fstype(fd, blk_device);
+	entry->last_used = tick;
+
+	close(fd);
+	return entry->type;
+}
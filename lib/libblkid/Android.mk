@@ -102,7 +102,9 @@ LOCAL_MODULE := libblkid
 LOCAL_MODULE_TAGS := optional
 #LOCAL_MODULE_PATH := $(TARGET_RECOVERY_ROOT_OUT)/sbin
 LOCAL_CFLAGS = -D_FILE_OFFSET_BITS=64 -DHAVE_LOFF_T -DHAVE_ERR_H -DHAVE_MEMPCPY -DHAVE_FSYNC
-LOCAL_SRC_FILES = 	src/cache.c \
+LOCAL_SRC_FILES = 	src/batch.c \
+			src/bincache.c \
+			src/cache.c \
 			src/config.c \
 			src/dev.c \
 			src/devname.c \
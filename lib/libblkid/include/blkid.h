@@ -225,6 +225,7 @@ extern void blkid_reset_probe(blkid_probe pr);
 
 extern int blkid_probe_set_device(blkid_probe pr, int fd,
 	                blkid_loff_t off, blkid_loff_t size);
+extern int blkid_probe_enable_mmap(blkid_probe pr, int enable);
 
 extern dev_t blkid_probe_get_devno(blkid_probe pr)
 			__ul_attribute__((nonnull));
@@ -364,6 +365,11 @@ extern blkid_partition blkid_parttable_get_parent(blkid_parttable tab);
 extern int blkid_do_probe(blkid_probe pr);
 extern int blkid_do_safeprobe(blkid_probe pr);
 extern int blkid_do_fullprobe(blkid_probe pr);
+extern int blkid_do_typeprobe(blkid_probe pr);
+
+typedef int (*blkid_batch_fn)(blkid_probe pr, const char *devname, void *data);
+extern int blkid_probe_batch(const char **devnames, size_t ndevs,
+			blkid_batch_fn fn, void *data);
 
 extern int blkid_probe_numof_values(blkid_probe pr);
 extern int blkid_probe_get_value(blkid_probe pr, int num, const char **name,
@@ -39,9 +39,35 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "crc32.h"
+#include "bitops.h"
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# include <emmintrin.h>
+# include <wmmintrin.h>
+# define CRC32_PCLMUL
+#endif
+
+#if defined(__aarch64__) && defined(__linux__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+# include <sys/auxv.h>
+# ifndef HWCAP_CRC32
+#  define HWCAP_CRC32	(1 << 7)
+# endif
+# if defined(__clang__)
+#  define CRC32_ARM64
+#  define CRC32_ARM64_TARGET	__attribute__((target("crc")))
+#  define crc32_arm64_b		__builtin_arm_crc32b
+#  define crc32_arm64_d		__builtin_arm_crc32d
+# elif defined(__GNUC__)
+#  define CRC32_ARM64
+#  define CRC32_ARM64_TARGET	__attribute__((target("+crc")))
+#  define crc32_arm64_b		__builtin_aarch64_crc32b
+#  define crc32_arm64_d		__builtin_aarch64_crc32x
+# endif
+#endif
 
 static const uint32_t crc32_tab[] = {
 	0x00000000L, 0x77073096L, 0xee0e612cL, 0x990951baL, 0x076dc419L,
@@ -98,6 +124,226 @@ static const uint32_t crc32_tab[] = {
 	0x2d02ef8dL
 };
 
+static uint32_t crc32_bytes(uint32_t crc, const unsigned char *p, size_t len)
+{
+	while (len) {
+		crc = crc32_tab[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+	return crc;
+}
+
+/*
+ * Slicing-by-8: crc32_tab8[n][i] is the CRC of byte i followed by n zero
+ * bytes, so eight bytes are processed by eight independent table lookups.
+ * The tables are computed from crc32_tab[] by crc32_init().
+ */
+static uint32_t crc32_tab8[8][256];
+
+static uint32_t crc32_slice8(uint32_t crc, const unsigned char *p, size_t len)
+{
+	for (; len && ((uintptr_t) p & 7); len--)
+		crc = crc32_tab[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	for (; len >= 8; len -= 8, p += 8) {
+		uint32_t lo, hi;
+
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo = le32_to_cpu(lo) ^ crc;
+		hi = le32_to_cpu(hi);
+
+		crc = crc32_tab8[7][lo & 0xff] ^
+		      crc32_tab8[6][(lo >> 8) & 0xff] ^
+		      crc32_tab8[5][(lo >> 16) & 0xff] ^
+		      crc32_tab8[4][lo >> 24] ^
+		      crc32_tab8[3][hi & 0xff] ^
+		      crc32_tab8[2][(hi >> 8) & 0xff] ^
+		      crc32_tab8[1][(hi >> 16) & 0xff] ^
+		      crc32_tab8[0][hi >> 24];
+	}
+
+	return crc32_bytes(crc, p, len);
+}
+
+#ifdef CRC32_PCLMUL
+/*
+ * Folding by carry-less multiplication, see "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009). The
+ * constants are for the bit-reflected 0x04C11DB7 polynomial. @len has to be
+ * multiple of 16 and at least 64 bytes.
+ */
+__attribute__((target("pclmul,sse2")))
+static uint32_t crc32_pclmul_fold(uint32_t crc, const unsigned char *buf, size_t len)
+{
+	static const uint64_t __attribute__((aligned(16)))
+		k1k2[] = { 0x0154442bd4, 0x01c6e41596 },
+		k3k4[] = { 0x01751997d0, 0x00ccaa009e },
+		k5k0[] = { 0x0163cd6124, 0x0000000000 },
+		poly[] = { 0x01db710641, 0x01f7011641 };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i *) (buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *) (buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *) (buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *) (buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *) k1k2);
+	buf += 64;
+	len -= 64;
+
+	/* fold 4 x 128 bits in parallel */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i *) (buf + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *) (buf + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *) (buf + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *) (buf + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		buf += 64;
+		len -= 64;
+	}
+
+	/* fold into 128 bits */
+	x0 = _mm_load_si128((const __m128i *) k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* fold the remaining 16-byte blocks */
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *) buf);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		buf += 16;
+		len -= 16;
+	}
+
+	/* fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i *) k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *) poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const unsigned char *p, size_t len)
+{
+	if (len >= 64) {
+		size_t n = len & ~(size_t) 15;
+
+		crc = crc32_pclmul_fold(crc, p, n);
+		p += n;
+		len -= n;
+	}
+	return crc32_slice8(crc, p, len);
+}
+#endif /* CRC32_PCLMUL */
+
+#ifdef CRC32_ARM64
+/*
+ * ARMv8 CRC32 instructions, they use the same polynomial and like crc32()
+ * don't invert the CRC.
+ */
+CRC32_ARM64_TARGET
+static uint32_t crc32_arm64(uint32_t crc, const unsigned char *p, size_t len)
+{
+	for (; len && ((uintptr_t) p & 7); len--)
+		crc = crc32_arm64_b(crc, *p++);
+
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64_t v;
+
+		memcpy(&v, p, 8);
+		crc = crc32_arm64_d(crc, v);
+	}
+
+	for (; len; len--)
+		crc = crc32_arm64_b(crc, *p++);
+	return crc;
+}
+#endif /* CRC32_ARM64 */
+
+typedef uint32_t (*crc32_fn)(uint32_t, const unsigned char *, size_t);
+
+static uint32_t crc32_init(uint32_t seed, const unsigned char *buf, size_t len);
+
+/* the best implementation for this CPU, selected on the first call */
+static crc32_fn crc32_impl = crc32_init;
+
+static uint32_t crc32_init(uint32_t seed, const unsigned char *buf, size_t len)
+{
+	crc32_fn fn = crc32_slice8;
+	size_t i, n;
+
+	for (i = 0; i < 256; i++) {
+		uint32_t crc = crc32_tab[i];
+
+		crc32_tab8[0][i] = crc;
+		for (n = 1; n < 8; n++) {
+			crc = crc32_tab[crc & 0xff] ^ (crc >> 8);
+			crc32_tab8[n][i] = crc;
+		}
+	}
+
+#ifdef CRC32_PCLMUL
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("pclmul"))
+		fn = crc32_pclmul;
+#endif
+#ifdef CRC32_ARM64
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+		fn = crc32_arm64;
+#endif
+	__sync_synchronize();
+	crc32_impl = fn;
+
+	return fn(seed, buf, len);
+}
+
 /*
  * This a generic crc32() function, it takes seed as an argument,
  * and does __not__ xor at the end. Then individual users can do
@@ -105,14 +351,107 @@ static const uint32_t crc32_tab[] = {
  */
 uint32_t crc32(uint32_t seed, const unsigned char *buf, size_t len)
 {
-	uint32_t crc = seed;
-	const unsigned char *p = buf;
+	return crc32_impl(seed, buf, len);
+}
 
-	while (len) {
-		crc = crc32_tab[(crc ^ *p++) & 0xff] ^ (crc >> 8);
-		len--;
-	}
+#ifdef TEST_PROGRAM
+#include <stdlib.h>
+#include <time.h>
 
-	return crc;
+static const struct {
+	const char	*name;
+	crc32_fn	fn;
+} crc32_impls[] = {
+	{ "bytes",  crc32_bytes },
+	{ "slice8", crc32_slice8 },
+#ifdef CRC32_PCLMUL
+	{ "pclmul", crc32_pclmul },
+#endif
+#ifdef CRC32_ARM64
+	{ "arm64",  crc32_arm64 },
+#endif
+};
+
+#define NIMPLS	(sizeof(crc32_impls) / sizeof(crc32_impls[0]))
+
+static int crc32_supported(crc32_fn fn)
+{
+#ifdef CRC32_PCLMUL
+	if (fn == crc32_pclmul)
+		return __builtin_cpu_supports("pclmul");
+#endif
+#ifdef CRC32_ARM64
+	if (fn == crc32_arm64)
+		return getauxval(AT_HWCAP) & HWCAP_CRC32 ? 1 : 0;
+#endif
+	return 1;
 }
 
+int main(int argc, char *argv[])
+{
+	static const unsigned char check[] = "123456789";
+	unsigned char *buf;
+	size_t i, len, off, bufsz = 16384;
+	int rc = EXIT_SUCCESS, loops = argc > 1 ? atoi(argv[1]) : 0;
+
+	buf = malloc(bufsz + 16);
+	if (!buf)
+		return EXIT_FAILURE;
+	srand(1);
+	for (i = 0; i < bufsz + 16; i++)
+		buf[i] = rand();
+
+	/* make sure the tables are ready */
+	crc32(0, buf, 0);
+
+	for (i = 0; i < NIMPLS; i++) {
+		crc32_fn fn = crc32_impls[i].fn;
+
+		if (!crc32_supported(fn)) {
+			printf("%-8s not supported\n", crc32_impls[i].name);
+			continue;
+		}
+		/* CRC-32 check value */
+		if ((fn(~0U, check, 9) ^ ~0U) != 0xcbf43926) {
+			printf("%-8s check value FAILED\n", crc32_impls[i].name);
+			rc = EXIT_FAILURE;
+			continue;
+		}
+		/* all lengths and alignments against the bytewise version */
+		for (len = 0; len <= 1024; len++) {
+			for (off = 0; off < 16; off++) {
+				uint32_t seed = rand();
+
+				if (fn(seed, buf + off, len) !=
+				    crc32_bytes(seed, buf + off, len)) {
+					printf("%-8s len=%zu off=%zu FAILED\n",
+						crc32_impls[i].name, len, off);
+					rc = EXIT_FAILURE;
+					goto next;
+				}
+			}
+		}
+		printf("%-8s OK\n", crc32_impls[i].name);
+
+		if (loops > 0) {
+			struct timespec a, b;
+			double s;
+			int l;
+
+			clock_gettime(CLOCK_MONOTONIC, &a);
+			for (l = 0; l < loops; l++)
+				buf[0] = fn(~0U, buf, bufsz);
+			clock_gettime(CLOCK_MONOTONIC, &b);
+			s = (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+			printf("%-8s %.0f MiB/s (%zu byte buffer)\n",
+				crc32_impls[i].name,
+				(double) bufsz * loops / s / (1 << 20), bufsz);
+		}
+	next:
+		;
+	}
+
+	free(buf);
+	return rc;
+}
+#endif /* TEST_PROGRAM */
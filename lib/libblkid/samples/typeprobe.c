@@ -0,0 +1,96 @@
+/*
+ * Compares blkid_do_fullprobe() and blkid_do_typeprobe() speed.
+ *
+ * This file may be redistributed under the terms of the
+ * GNU Lesser General Public License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include <blkid.h>
+
+#include "c.h"
+
+#define DEFAULT_LOOPS	1000
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* returns average microseconds per probe, @type gets the detected type */
+static double bench(const char *devname, int loops, int typeonly,
+		    char *type, size_t typesz)
+{
+	double start = now_us();
+	int i;
+
+	*type = '\0';
+
+	for (i = 0; i < loops; i++) {
+		const char *data;
+		blkid_probe pr;
+		int rc;
+
+		pr = blkid_new_probe_from_filename(devname);
+		if (!pr)
+			err(EXIT_FAILURE, "%s: faild to create a new libblkid probe",
+					devname);
+
+		rc = typeonly ? blkid_do_typeprobe(pr) : blkid_do_fullprobe(pr);
+		if (rc == -1)
+			errx(EXIT_FAILURE, "%s: probing failed", devname);
+
+		if (i == 0 && rc == 0 &&
+		    blkid_probe_lookup_value(pr, "TYPE", &data, NULL) == 0)
+			snprintf(type, typesz, "%s", data);
+
+		blkid_free_probe(pr);
+	}
+
+	return (now_us() - start) / loops;
+}
+
+int main(int argc, char *argv[])
+{
+	int i = 1, loops = DEFAULT_LOOPS;
+
+	if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+		loops = atoi(argv[2]);
+		i = 3;
+	}
+	if (i >= argc || loops <= 0) {
+		fprintf(stderr, "usage: %s [-n <loops>] <device> [<device> ...]  "
+				"-- compares full and type-only probing\n",
+				program_invocation_short_name);
+		return EXIT_FAILURE;
+	}
+
+	printf("%-24s %-10s %12s %12s %8s\n",
+			"DEVICE", "TYPE", "FULL [us]", "TYPE [us]", "SPEEDUP");
+
+	for ( ; i < argc; i++) {
+		char full_type[64], fast_type[64];
+		double full, fast;
+
+		full = bench(argv[i], loops, 0, full_type, sizeof(full_type));
+		fast = bench(argv[i], loops, 1, fast_type, sizeof(fast_type));
+
+		if (strcmp(full_type, fast_type) != 0)
+			warnx("%s: type mismatch: full=%s typeonly=%s", argv[i],
+					full_type, fast_type);
+
+		printf("%-24s %-10s %12.1f %12.1f %7.2fx\n", argv[i],
+				*fast_type ? fast_type : "-", full, fast,
+				fast > 0 ? full / fast : 0);
+	}
+
+	return EXIT_SUCCESS;
+}
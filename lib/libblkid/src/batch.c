@@ -0,0 +1,179 @@
+/*
+ * batch.c - probe many devices with overlapped I/O
+ *
+ * This file may be redistributed under the terms of the
+ * GNU Lesser General Public License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "blkidP.h"
+
+/* max. number of devices read at the same time */
+#define BLKID_BATCH_THREADS	8
+
+struct blkid_batch_item {
+	const char	*devname;
+	blkid_probe	pr;
+};
+
+struct blkid_batch {
+	struct blkid_batch_item	*items;
+	size_t			nitems;
+
+	size_t			next;	/* next item to open and read */
+	int			stop;	/* caller is not interested anymore */
+
+	size_t			*ready;	/* items in order of completion */
+	size_t			nready;
+
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+};
+
+static void *batch_worker(void *data)
+{
+	struct blkid_batch *b = (struct blkid_batch *) data;
+
+	for (;;) {
+		size_t i = __sync_fetch_and_add(&b->next, 1);
+		struct blkid_batch_item *it;
+
+		if (i >= b->nitems)
+			break;
+
+		it = &b->items[i];
+		if (!__sync_fetch_and_add(&b->stop, 0)) {
+			it->pr = blkid_new_probe_from_filename(it->devname);
+			if (it->pr)
+				blkid_probe_prefetch(it->pr);
+		}
+
+		pthread_mutex_lock(&b->lock);
+		b->ready[b->nready++] = i;
+		pthread_cond_signal(&b->cond);
+		pthread_mutex_unlock(&b->lock);
+	}
+	return NULL;
+}
+
+/**
+ * blkid_probe_batch:
+ * @devnames: array of device names
+ * @ndevs: number of devices
+ * @fn: function to call for every device
+ * @data: private data for @fn
+ *
+ * Probes many devices at once. The devices are opened and the areas where
+ * the superblocks and partition tables usually are (begin and end of the
+ * device) are read by a pool of threads, so the I/O of all devices overlaps.
+ *
+ * @fn is called in the caller's thread, one device after another in order
+ * in which the reads are finished. The probe passed to @fn is ready to use
+ * (e.g. blkid_do_safeprobe()) and is deallocated after @fn returns; it is
+ * NULL if the device cannot be opened. If @fn returns non-zero, @fn is not
+ * called for the remaining devices.
+ *
+ * Returns: 0 on success, the non-zero return value of @fn or negative
+ * number in case of error.
+ */
+int blkid_probe_batch(const char **devnames, size_t ndevs,
+		      blkid_batch_fn fn, void *data)
+{
+	struct blkid_batch b;
+	pthread_t threads[BLKID_BATCH_THREADS];
+	size_t i, nthreads = 0, done = 0;
+	int rc = 0;
+
+	if (!devnames || !fn)
+		return -EINVAL;
+	if (!ndevs)
+		return 0;
+
+	memset(&b, 0, sizeof(b));
+	b.items = calloc(ndevs, sizeof(struct blkid_batch_item));
+	b.ready = calloc(ndevs, sizeof(size_t));
+	if (!b.items || !b.ready) {
+		free(b.items);
+		free(b.ready);
+		return -ENOMEM;
+	}
+	b.nitems = ndevs;
+	for (i = 0; i < ndevs; i++)
+		b.items[i].devname = devnames[i];
+
+	pthread_mutex_init(&b.lock, NULL);
+	pthread_cond_init(&b.cond, NULL);
+
+	while (nthreads < BLKID_BATCH_THREADS && nthreads < ndevs &&
+	       pthread_create(&threads[nthreads], NULL, batch_worker, &b) == 0)
+		nthreads++;
+
+	DBG(LOWPROBE, ul_debug("batch: %zu devices, %zu threads",
+				ndevs, nthreads));
+
+	/* no threads, read everything here */
+	if (!nthreads)
+		batch_worker(&b);
+
+	while (done < ndevs) {
+		struct blkid_batch_item *it;
+
+		pthread_mutex_lock(&b.lock);
+		while (done == b.nready)
+			pthread_cond_wait(&b.cond, &b.lock);
+		it = &b.items[b.ready[done]];
+		pthread_mutex_unlock(&b.lock);
+		done++;
+
+		if (!rc) {
+			rc = fn(it->pr, it->devname, data);
+			if (rc)
+				__sync_fetch_and_add(&b.stop, 1);
+		}
+		blkid_free_probe(it->pr);
+		it->pr = NULL;
+	}
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_cond_destroy(&b.cond);
+	pthread_mutex_destroy(&b.lock);
+	free(b.items);
+	free(b.ready);
+	return rc;
+}
+
+#ifdef TEST_PROGRAM
+static int print_type(blkid_probe pr, const char *devname,
+		      void *data __attribute__((__unused__)))
+{
+	const char *type = NULL;
+
+	if (!pr) {
+		printf("%s: cannot open\n", devname);
+		return 0;
+	}
+	if (blkid_do_typeprobe(pr) == 0)
+		blkid_probe_lookup_value(pr, "TYPE", &type, NULL);
+	printf("%s: %s\n", devname, type ? type : "(none)");
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <device> [<device> ...]\n"
+			"Probe the devices in one batch\n", argv[0]);
+		exit(1);
+	}
+	blkid_init_debug(0);
+	return blkid_probe_batch((const char **) argv + 1, argc - 1,
+				 print_type, NULL) ? 1 : 0;
+}
+#endif
@@ -0,0 +1,436 @@
+/*
+ * bincache.c - binary cache file
+ *
+ * This file may be redistributed under the terms of the
+ * GNU Lesser General Public License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include "blkidP.h"
+
+/*
+ * File format (all numbers are in the byte order of the writer):
+ *
+ *	header		struct bc_header
+ *	devices		struct bc_dev[ndevs]
+ *	tags		struct bc_tag[ntags], tags of one device are adjacent
+ *	index		uint32_t[ntags], tags sorted by NAME and VALUE
+ *	strings		NUL terminated names and values
+ *
+ * The file is mmapped by blkid_read_cache() and the devices are imported to
+ * the cache lists only when something walks the lists. Tag lookups go to the
+ * sorted index, so blkid_find_dev_with_tag() imports only the device it
+ * returns.
+ */
+#define BC_MAGIC	"BLKIDBC"
+#define BC_VERSION	1
+#define BC_BYTEORDER	0x01020304
+
+struct bc_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	byteorder;
+	uint32_t	size;		/* size of the file */
+	uint32_t	ndevs;		/* number of devices */
+	uint32_t	ntags;		/* number of tags */
+	uint32_t	strsz;		/* size of the string pool */
+};
+
+struct bc_dev {
+	uint64_t	devno;
+	int64_t		time;
+	int64_t		utime;
+	int32_t		pri;
+	uint32_t	name;		/* string pool offset */
+	uint32_t	tag;		/* first tag */
+	uint32_t	ntags;		/* number of tags */
+};
+
+struct bc_tag {
+	uint32_t	name;		/* string pool offset */
+	uint32_t	value;		/* string pool offset */
+	uint32_t	dev;		/* device index */
+};
+
+#define bc_header(m)	((struct bc_header *) (m))
+#define bc_devs(m)	((struct bc_dev *) ((char *) (m) + sizeof(struct bc_header)))
+#define bc_tags(m)	((struct bc_tag *) (bc_devs(m) + bc_header(m)->ndevs))
+#define bc_index(m)	((uint32_t *) (bc_tags(m) + bc_header(m)->ntags))
+#define bc_strings(m)	((char *) (bc_index(m) + bc_header(m)->ntags))
+
+#define bc_str(m, off)	(bc_strings(m) + (off))
+
+static size_t bc_size(uint32_t ndevs, uint32_t ntags, uint32_t strsz)
+{
+	return sizeof(struct bc_header) +
+	       (size_t) ndevs * sizeof(struct bc_dev) +
+	       (size_t) ntags * (sizeof(struct bc_tag) + sizeof(uint32_t)) +
+	       strsz;
+}
+
+/* checks all offsets, so the file can be used without further checks */
+static int bc_verify(void *m, size_t size)
+{
+	struct bc_header *hdr = bc_header(m);
+	struct bc_dev *devs;
+	struct bc_tag *tags;
+	uint32_t *idx, i;
+
+	if (hdr->version != BC_VERSION || hdr->byteorder != BC_BYTEORDER ||
+	    hdr->size != size || !hdr->strsz ||
+	    bc_size(hdr->ndevs, hdr->ntags, hdr->strsz) != size)
+		return -1;
+	if (bc_strings(m)[hdr->strsz - 1] != '\0')
+		return -1;
+
+	devs = bc_devs(m);
+	tags = bc_tags(m);
+	idx = bc_index(m);
+
+	for (i = 0; i < hdr->ndevs; i++) {
+		if (devs[i].name >= hdr->strsz ||
+		    devs[i].tag > hdr->ntags ||
+		    devs[i].ntags > hdr->ntags - devs[i].tag)
+			return -1;
+	}
+	for (i = 0; i < hdr->ntags; i++) {
+		if (tags[i].name >= hdr->strsz ||
+		    tags[i].value >= hdr->strsz ||
+		    tags[i].dev >= hdr->ndevs ||
+		    idx[i] >= hdr->ntags)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Maps the cache file if it's in the binary format.
+ *
+ * Returns 1 if the file has been mapped, 0 if it's not a binary cache file
+ * or negative number in case of error.
+ */
+int blkid_bincache_map(blkid_cache cache, int fd, struct stat *st)
+{
+	struct bc_header hdr;
+	unsigned char *done;
+	void *m;
+
+	if (!S_ISREG(st->st_mode) || st->st_size < (off_t) sizeof(hdr))
+		return 0;
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, BC_MAGIC, sizeof(hdr.magic)) != 0)
+		return 0;
+	if ((uint64_t) st->st_size != hdr.size) {
+		DBG(READ, ul_debug("binary cache: wrong size"));
+		return -BLKID_ERR_CACHE;
+	}
+
+	m = mmap(NULL, hdr.size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (m == MAP_FAILED)
+		return -BLKID_ERR_MEM;
+	if (bc_verify(m, hdr.size) != 0) {
+		DBG(READ, ul_debug("binary cache: corrupted"));
+		munmap(m, hdr.size);
+		return -BLKID_ERR_CACHE;
+	}
+	done = calloc(hdr.ndevs / 8 + 1, 1);
+	if (!done) {
+		munmap(m, hdr.size);
+		return -BLKID_ERR_MEM;
+	}
+
+	/* the previous file is merged into the cache as with text files */
+	blkid_bincache_load(cache);
+
+	cache->bic_map = m;
+	cache->bic_maplen = hdr.size;
+	cache->bic_mapdone = done;
+
+	DBG(READ, ul_debug("binary cache: %u devices, %u tags",
+				hdr.ndevs, hdr.ntags));
+	return 1;
+}
+
+void blkid_bincache_unmap(blkid_cache cache)
+{
+	if (!cache->bic_map)
+		return;
+	munmap(cache->bic_map, cache->bic_maplen);
+	free(cache->bic_mapdone);
+	cache->bic_map = NULL;
+	cache->bic_maplen = 0;
+	cache->bic_mapdone = NULL;
+}
+
+/* adds device @i from the mapped file to the cache lists */
+static blkid_dev bincache_import_dev(blkid_cache cache, uint32_t i)
+{
+	void *m = cache->bic_map;
+	struct bc_dev *d = &bc_devs(m)[i];
+	struct bc_tag *tags = bc_tags(m);
+	const char *name = bc_str(m, d->name);
+	unsigned int changed = cache->bic_flags & BLKID_BIC_FL_CHANGED;
+	blkid_dev dev = NULL;
+	struct list_head *p;
+	uint32_t t;
+
+	cache->bic_mapdone[i / 8] |= 1 << (i % 8);
+
+	list_for_each(p, &cache->bic_devs) {
+		blkid_dev tmp = list_entry(p, struct blkid_struct_dev, bid_devs);
+		if (strcmp(tmp->bid_name, name) == 0) {
+			dev = tmp;
+			break;
+		}
+	}
+	if (!dev) {
+		if (access(name, F_OK) < 0)
+			return NULL;
+		dev = blkid_new_dev();
+		if (!dev)
+			return NULL;
+		dev->bid_name = strdup(name);
+		if (!dev->bid_name) {
+			blkid_free_dev(dev);
+			return NULL;
+		}
+		dev->bid_cache = cache;
+		list_add_tail(&dev->bid_devs, &cache->bic_devs);
+	}
+
+	dev->bid_devno = d->devno;
+	dev->bid_time = d->time;
+	dev->bid_utime = d->utime;
+	dev->bid_pri = d->pri;
+
+	for (t = d->tag; t < d->tag + d->ntags; t++) {
+		const char *value = bc_str(m, tags[t].value);
+		blkid_set_tag(dev, bc_str(m, tags[t].name), value, strlen(value));
+	}
+
+	/* importing data from the file is not a change */
+	if (!changed)
+		cache->bic_flags &= ~BLKID_BIC_FL_CHANGED;
+
+	DBG(READ, ul_debug("imported dev %s", dev->bid_name));
+	return dev;
+}
+
+#define bincache_is_done(c, i)	((c)->bic_mapdone[(i) / 8] & (1 << ((i) % 8)))
+
+/*
+ * Imports all not yet imported devices from the mapped cache file and
+ * unmaps the file.
+ */
+void blkid_bincache_load(blkid_cache cache)
+{
+	uint32_t i, n;
+
+	if (!cache->bic_map)
+		return;
+
+	n = bc_header(cache->bic_map)->ndevs;
+	for (i = 0; i < n; i++) {
+		if (!bincache_is_done(cache, i))
+			bincache_import_dev(cache, i);
+	}
+	blkid_bincache_unmap(cache);
+}
+
+static int bc_tag_cmp(void *m, uint32_t t, const char *type, const char *value)
+{
+	struct bc_tag *tag = &bc_tags(m)[t];
+	int rc = strcmp(bc_str(m, tag->name), type);
+
+	return rc ? rc : strcmp(bc_str(m, tag->value), value);
+}
+
+/*
+ * Looks up @type=@value in the index of the mapped cache file and imports
+ * the device with the highest priority.
+ */
+blkid_dev blkid_bincache_find(blkid_cache cache, const char *type,
+			      const char *value)
+{
+	void *m = cache->bic_map;
+	uint32_t *idx, lo, hi, best = UINT32_MAX;
+	int pri = -1;
+
+	if (!m)
+		return NULL;
+
+	idx = bc_index(m);
+	lo = 0;
+	hi = bc_header(m)->ntags;
+
+	/* first tag not less than type=value */
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (bc_tag_cmp(m, idx[mid], type, value) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < bc_header(m)->ntags &&
+	       bc_tag_cmp(m, idx[lo], type, value) == 0; lo++) {
+		uint32_t i = bc_tags(m)[idx[lo]].dev;
+		struct bc_dev *d = &bc_devs(m)[i];
+
+		if (bincache_is_done(cache, i) || d->pri <= pri ||
+		    access(bc_str(m, d->name), F_OK) != 0)
+			continue;
+		best = i;
+		pri = d->pri;
+	}
+
+	if (best == UINT32_MAX)
+		return NULL;
+
+	DBG(TAG, ul_debug("found %s=%s in binary cache", type, value));
+	return bincache_import_dev(cache, best);
+}
+
+struct bc_sort {
+	const char	*name;
+	const char	*value;
+	uint32_t	tag;
+};
+
+static int bc_sort_cmp(const void *a, const void *b)
+{
+	const struct bc_sort *x = a, *y = b;
+	int rc = strcmp(x->name, y->name);
+
+	if (!rc)
+		rc = strcmp(x->value, y->value);
+	return rc ? rc : (x->tag > y->tag) - (x->tag < y->tag);
+}
+
+static int bincache_want_dev(blkid_dev dev)
+{
+	return dev->bid_type && dev->bid_name[0] == '/' &&
+	       !(dev->bid_flags & BLKID_BID_FL_REMOVABLE);
+}
+
+static uint32_t bc_add_str(char *pool, uint32_t *off, const char *str)
+{
+	uint32_t res = *off;
+	size_t len = strlen(str) + 1;
+
+	memcpy(pool + res, str, len);
+	*off += len;
+	return res;
+}
+
+/*
+ * Writes devices from the cache lists to @file in the binary format.
+ */
+int blkid_bincache_save(blkid_cache cache, FILE *file)
+{
+	struct list_head *p, *t;
+	struct bc_header *hdr;
+	struct bc_dev *devs;
+	struct bc_tag *tags;
+	struct bc_sort *sort = NULL;
+	uint32_t ndevs = 0, ntags = 0, strsz = 0, d, i, off = 0;
+	size_t size;
+	void *m;
+	int rc = 0;
+
+	list_for_each(p, &cache->bic_devs) {
+		blkid_dev dev = list_entry(p, struct blkid_struct_dev, bid_devs);
+
+		if (!bincache_want_dev(dev))
+			continue;
+		ndevs++;
+		strsz += strlen(dev->bid_name) + 1;
+		list_for_each(t, &dev->bid_tags) {
+			blkid_tag tag = list_entry(t, struct blkid_struct_tag, bit_tags);
+
+			ntags++;
+			strsz += strlen(tag->bit_name) + strlen(tag->bit_val) + 2;
+		}
+	}
+	if (!strsz)
+		strsz = 1;
+
+	size = bc_size(ndevs, ntags, strsz);
+	m = calloc(1, size);
+	if (ntags)
+		sort = calloc(ntags, sizeof(struct bc_sort));
+	if (!m || (ntags && !sort)) {
+		rc = -BLKID_ERR_MEM;
+		goto done;
+	}
+
+	hdr = bc_header(m);
+	memcpy(hdr->magic, BC_MAGIC, sizeof(hdr->magic));
+	hdr->version = BC_VERSION;
+	hdr->byteorder = BC_BYTEORDER;
+	hdr->size = size;
+	hdr->ndevs = ndevs;
+	hdr->ntags = ntags;
+	hdr->strsz = strsz;
+
+	devs = bc_devs(m);
+	tags = bc_tags(m);
+	d = i = 0;
+
+	list_for_each(p, &cache->bic_devs) {
+		blkid_dev dev = list_entry(p, struct blkid_struct_dev, bid_devs);
+
+		if (!bincache_want_dev(dev))
+			continue;
+
+		DBG(SAVE, ul_debug("device %s, type %s", dev->bid_name,
+					dev->bid_type));
+
+		devs[d].devno = dev->bid_devno;
+		devs[d].time = dev->bid_time;
+		devs[d].utime = dev->bid_utime;
+		devs[d].pri = dev->bid_pri;
+		devs[d].name = bc_add_str(bc_strings(m), &off, dev->bid_name);
+		devs[d].tag = i;
+
+		list_for_each(t, &dev->bid_tags) {
+			blkid_tag tag = list_entry(t, struct blkid_struct_tag, bit_tags);
+
+			tags[i].name = bc_add_str(bc_strings(m), &off, tag->bit_name);
+			tags[i].value = bc_add_str(bc_strings(m), &off, tag->bit_val);
+			tags[i].dev = d;
+
+			sort[i].name = tag->bit_name;
+			sort[i].value = tag->bit_val;
+			sort[i].tag = i;
+			i++;
+		}
+		devs[d].ntags = i - devs[d].tag;
+		d++;
+	}
+
+	if (ntags) {
+		qsort(sort, ntags, sizeof(struct bc_sort), bc_sort_cmp);
+		for (i = 0; i < ntags; i++)
+			bc_index(m)[i] = sort[i].tag;
+	}
+
+	if (fwrite(m, 1, size, file) != size)
+		rc = -BLKID_ERR_IO;
+done:
+	free(sort);
+	free(m);
+	return rc;
+}
@@ -56,6 +56,7 @@ struct blkid_struct_dev
 #define BLKID_BID_FL_VERIFIED	0x0001	/* Device data validated from disk */
 #define BLKID_BID_FL_INVALID	0x0004	/* Device is invalid */
 #define BLKID_BID_FL_REMOVABLE	0x0008	/* Device added by blkid_probe_all_removable() */
+#define BLKID_BID_FL_PENDING	0x0010	/* Device waits for blkid_verify_devs() */
 
 /*
  * Each tag defines a NAME=value pair for a particular device.  The tags
@@ -68,6 +69,7 @@ struct blkid_struct_tag
 {
 	struct list_head	bit_tags;	/* All tags for this device */
 	struct list_head	bit_names;	/* All tags with given NAME */
+	struct list_head	bit_hash;	/* Tags in the same hash bucket */
 	char			*bit_name;	/* NAME of tag (shared) */
 	char			*bit_val;	/* value of tag */
 	blkid_dev		bit_dev;	/* pointer to device */
@@ -203,7 +205,13 @@ struct blkid_struct_probe
 	blkid_loff_t		wipe_size;	/* size of the wiped area */
 	struct blkid_chain	*wipe_chain;	/* superblock, partition, ... */
 
-	struct list_head	buffers;	/* list of buffers */
+	struct list_head	buffers;	/* list of buffers (sorted by offset) */
+	uint64_t		io_reads;	/* read() calls on the device */
+	uint64_t		io_bytes;	/* bytes read from the device */
+
+	unsigned char		*mmap_data;	/* mapped file or NULL */
+	size_t			mmap_len;	/* size of the mapping */
+	blkid_loff_t		mmap_skip;	/* pr->off within the mapping */
 
 	struct blkid_chain	chains[BLKID_NCHAINS];	/* array of chains */
 	struct blkid_chain	*cur_chain;		/* current chain */
@@ -215,11 +223,20 @@ struct blkid_struct_probe
 	struct blkid_struct_probe *disk_probe;	/* whole-disk probing */
 };
 
+/* buffer reads are extended to whole aligned blocks of this size */
+#define BLKID_PROBE_READ_ALIGN	4096
+/* read at the begin and at the end of the device before probing */
+#define BLKID_PROBE_PREFETCH	(64 * 1024)
+/* read size for requests right behind an already cached area */
+#define BLKID_PROBE_READAHEAD	(64 * 1024)
+
 /* private flags library flags */
 #define BLKID_FL_PRIVATE_FD	(1 << 1)	/* see blkid_new_probe_from_filename() */
 #define BLKID_FL_TINY_DEV	(1 << 2)	/* <= 1.47MiB (floppy or so) */
 #define BLKID_FL_CDROM_DEV	(1 << 3)	/* is a CD/DVD drive */
 #define BLKID_FL_NOSCAN_DEV	(1 << 4)	/* do not scan this device */
+#define BLKID_FL_MMAP		(1 << 5)	/* mmap regular files */
+#define BLKID_FL_MMAP_FAILED	(1 << 6)	/* don't try to mmap again */
 
 /* private per-probing flags */
 #define BLKID_PROBE_FL_IGNORE_PT (1 << 1)	/* ignore partition table */
@@ -245,6 +262,7 @@ struct blkid_config {
 	int nevals;			/* number of elems in eval array */
 	int uevent;			/* SEND_UEVENT=<yes|not> option */
 	char *cachefile;		/* CACHE_FILE=<path> option */
+	int textcache;			/* CACHE_FORMAT=<binary|text> option */
 };
 
 extern struct blkid_config *blkid_read_config(const char *filename)
@@ -265,6 +283,11 @@ extern void blkid_free_config(struct blkid_config *conf);
  */
 #define BLKID_PROBE_INTERVAL	200
 
+/*
+ * Max. number of threads used to verify devices in blkid_probe_all().
+ */
+#define BLKID_VERIFY_THREADS_MAX	32
+
 /* This describes an entire blkid cache file and probed devices.
  * We can traverse all of the found devices via bic_list.
  * We can traverse all of the tag types by bic_tags, which hold empty tags
@@ -280,10 +303,18 @@ struct blkid_struct_cache
 	unsigned int		bic_flags;	/* Status flags of the cache */
 	char			*bic_filename;	/* filename of cache */
 	blkid_probe		probe;		/* low-level probing stuff */
+	void			*bic_map;	/* mmapped binary cache file */
+	size_t			bic_maplen;	/* size of the mapping */
+	unsigned char		*bic_mapdone;	/* bitmap of imported devices */
+	struct list_head	*bic_hash;	/* Tags hashed by NAME and VALUE */
+	size_t			bic_hashsz;	/* Number of buckets (power of 2) */
+	size_t			bic_nhashed;	/* Number of tags in bic_hash */
 };
 
 #define BLKID_BIC_FL_PROBED	0x0002	/* We probed /proc/partition devices */
 #define BLKID_BIC_FL_CHANGED	0x0004	/* Cache has changed from disk */
+#define BLKID_BIC_FL_DEFER	0x0008	/* Verify new devices by blkid_verify_devs() */
+#define BLKID_BIC_FL_TEXT	0x0010	/* Write the cache file in the text format */
 
 /* config file */
 #define BLKID_CONFIG_FILE	"/etc/blkid.conf"
@@ -360,6 +391,19 @@ extern void blkid_read_cache(blkid_cache cache)
 extern int blkid_flush_cache(blkid_cache cache)
 			__attribute__((nonnull));
 
+/* bincache.c */
+extern int blkid_bincache_map(blkid_cache cache, int fd, struct stat *st)
+			__attribute__((nonnull));
+extern void blkid_bincache_unmap(blkid_cache cache)
+			__attribute__((nonnull));
+extern void blkid_bincache_load(blkid_cache cache)
+			__attribute__((nonnull));
+extern blkid_dev blkid_bincache_find(blkid_cache cache, const char *type,
+				     const char *value)
+			__attribute__((nonnull));
+extern int blkid_bincache_save(blkid_cache cache, FILE *file)
+			__attribute__((nonnull));
+
 /* cache */
 extern char *blkid_safe_getenv(const char *arg)
 			__attribute__((nonnull))
@@ -386,6 +430,10 @@ extern blkid_dev blkid_new_dev(void)
 			__attribute__((warn_unused_result));
 extern void blkid_free_dev(blkid_dev dev);
 
+/* verify.c */
+extern int blkid_verify_threads(void);
+extern void blkid_verify_devs(blkid_cache cache, int pending, int nthreads);
+
 /* probe.c */
 extern int blkid_probe_is_tiny(blkid_probe pr)
 			__attribute__((nonnull))
@@ -399,6 +447,9 @@ extern unsigned char *blkid_probe_get_buffer(blkid_probe pr,
 			__attribute__((nonnull))
 			__attribute__((warn_unused_result));
 
+extern void blkid_probe_prefetch(blkid_probe pr)
+			__attribute__((nonnull));
+
 extern unsigned char *blkid_probe_get_sector(blkid_probe pr, unsigned int sector)
 			__attribute__((nonnull))
 			__attribute__((warn_unused_result));
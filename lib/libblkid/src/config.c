@@ -97,6 +97,15 @@ static int parse_next(FILE *fd, struct blkid_config *conf)
 		s += 11;
 		if (*s)
 			conf->cachefile = strdup(s);
+	} else if (!strncmp(s, "CACHE_FORMAT=", 13)) {
+		s += 13;
+		if (*s && !strcasecmp(s, "text"))
+			conf->textcache = TRUE;
+		else if (*s && strcasecmp(s, "binary")) {
+			DBG(CONFIG, ul_debug(
+				"config file: unknown cache format '%s'.", s));
+			return -1;
+		}
 	} else if (!strncmp(s, "EVALUATE=", 9)) {
 		s += 9;
 		if (*s && parse_evaluate(conf, s) == -1)
@@ -191,6 +200,7 @@ int main(int argc, char *argv[])
 
 	printf("SEND UEVENT: %s\n", conf->uevent ? "TRUE" : "FALSE");
 	printf("CACHE_FILE:  %s\n", conf->cachefile);
+	printf("CACHE_FORMAT: %s\n", conf->textcache ? "text" : "binary");
 
 	blkid_free_config(conf);
 	return EXIT_SUCCESS;
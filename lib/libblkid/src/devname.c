@@ -55,6 +55,8 @@ blkid_dev blkid_get_dev(blkid_cache cache, const char *devname, int flags)
 	if (!cache || !devname)
 		return NULL;
 
+	blkid_bincache_load(cache);
+
 	list_for_each(p, &cache->bic_devs) {
 		tmp = list_entry(p, struct blkid_struct_dev, bid_devs);
 		if (strcmp(tmp->bid_name, devname))
@@ -221,7 +223,13 @@ static void probe_one(blkid_cache cache, const char *ptname,
 	}
 
 get_dev:
-	dev = blkid_get_dev(cache, devname, BLKID_DEV_NORMAL);
+	if (cache->bic_flags & BLKID_BIC_FL_DEFER) {
+		/* verified later by blkid_verify_devs() */
+		dev = blkid_get_dev(cache, devname, BLKID_DEV_CREATE);
+		if (dev && !(dev->bid_flags & BLKID_BID_FL_VERIFIED))
+			dev->bid_flags |= BLKID_BID_FL_PENDING;
+	} else
+		dev = blkid_get_dev(cache, devname, BLKID_DEV_NORMAL);
 	free(devname);
 
 set_pri:
@@ -412,6 +420,17 @@ ubi_probe_all(blkid_cache cache, int only_if_new)
 	}
 }
 
+/*
+ * Verify devices added by probe_one() while BLKID_BIC_FL_DEFER is set.
+ */
+static void probe_all_pending(blkid_cache cache, int nthreads)
+{
+	if (!(cache->bic_flags & BLKID_BIC_FL_DEFER))
+		return;
+	cache->bic_flags &= ~BLKID_BIC_FL_DEFER;
+	blkid_verify_devs(cache, 1, nthreads);
+}
+
 /*
  * Read the device data for all available block devices in the system.
  */
@@ -425,7 +444,7 @@ static int probe_all(blkid_cache cache, int only_if_new)
 	int ma, mi;
 	unsigned long long sz;
 	int lens[2] = { 0, 0 };
-	int which = 0, last = 0;
+	int which = 0, last = 0, nthreads;
 	struct list_head *p, *pnext;
 
 	ptnames[0] = ptname0;
@@ -439,6 +458,18 @@ static int probe_all(blkid_cache cache, int only_if_new)
 		return 0;
 
 	blkid_read_cache(cache);
+	blkid_bincache_load(cache);
+
+	/*
+	 * Parallel mode: refresh the devices we already know by a pool of
+	 * threads. New devices are only collected and probed at the end, by
+	 * one batch which reads all of them at once.
+	 */
+	nthreads = blkid_verify_threads();
+	if (nthreads > 1 && !only_if_new)
+		blkid_verify_devs(cache, 0, nthreads);
+	cache->bic_flags |= BLKID_BIC_FL_DEFER;
+
 	evms_probe_all(cache, only_if_new);
 #ifdef VG_DIR
 	lvm_probe_all(cache, only_if_new);
@@ -446,8 +477,10 @@ static int probe_all(blkid_cache cache, int only_if_new)
 	ubi_probe_all(cache, only_if_new);
 
 	proc = fopen(PROC_PARTITIONS, "r" UL_CLOEXECSTR);
-	if (!proc)
+	if (!proc) {
+		probe_all_pending(cache, nthreads);
 		return -BLKID_ERR_PROC;
+	}
 
 	while (fgets(line, sizeof(line), proc)) {
 		last = which;
@@ -527,6 +560,7 @@ static int probe_all(blkid_cache cache, int only_if_new)
 		probe_one(cache, ptname, devs[which], 0, only_if_new, 0);
 
 	fclose(proc);
+	probe_all_pending(cache, nthreads);
 	blkid_flush_cache(cache);
 	return 0;
 }
@@ -541,6 +575,8 @@ static int probe_all_removable(blkid_cache cache)
 	if (!cache)
 		return -BLKID_ERR_PARAM;
 
+	blkid_bincache_load(cache);
+
 	dir = opendir(_PATH_SYS_BLOCK);
 	if (!dir)
 		return -BLKID_ERR_PROC;
@@ -91,6 +91,7 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #ifdef HAVE_LINUX_CDROM_H
 #include <linux/cdrom.h>
 #endif
@@ -131,6 +132,7 @@ static const struct blkid_chaindrv *chains_drvs[] = {
 
 static void blkid_probe_reset_vals(blkid_probe pr);
 static void blkid_probe_reset_buffer(blkid_probe pr);
+static void blkid_probe_unmap(blkid_probe pr);
 
 /**
  * blkid_new_probe:
@@ -260,6 +262,7 @@ void blkid_free_probe(blkid_probe pr)
 	if ((pr->flags & BLKID_FL_PRIVATE_FD) && pr->fd >= 0)
 		close(pr->fd);
 	blkid_probe_reset_buffer(pr);
+	blkid_probe_unmap(pr);
 	blkid_free_probe(pr->disk_probe);
 
 	DBG(LOWPROBE, ul_debug("free probe %p", pr));
@@ -535,11 +538,194 @@ int __blkid_probe_filter_types(blkid_probe pr, int chain, int flag, char *names[
 	return 0;
 }
 
+/*
+ * Maps the probing area of a regular file, see blkid_probe_enable_mmap().
+ */
+static int blkid_probe_map(blkid_probe pr)
+{
+	long pagesz = sysconf(_SC_PAGESIZE);
+	blkid_loff_t start, len;
+	struct stat sb;
+	void *data;
+
+	if (!S_ISREG(pr->mode) || pr->size <= 0 || pagesz <= 0)
+		return -1;
+
+	/* accessing a mapping past the end of the file raises SIGBUS */
+	if (fstat(pr->fd, &sb) || pr->off + pr->size > sb.st_size)
+		return -1;
+
+	start = pr->off & ~((blkid_loff_t) pagesz - 1);
+	len = pr->off + pr->size - start;
+	if ((uint64_t) len > SIZE_MAX)
+		return -1;
+
+	/* private and writable, some probers modify the buffers in place */
+	data = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+			pr->fd, start);
+	if (data == MAP_FAILED) {
+		DBG(LOWPROBE, ul_debug("mmap failed: %m"));
+		return -1;
+	}
+
+	DBG(LOWPROBE, ul_debug("mapped %jd bytes pr=%p", len, pr));
+
+	pr->mmap_data = data;
+	pr->mmap_len = len;
+	pr->mmap_skip = pr->off - start;
+	return 0;
+}
+
+static void blkid_probe_unmap(blkid_probe pr)
+{
+	if (pr->mmap_data) {
+		munmap(pr->mmap_data, pr->mmap_len);
+		pr->mmap_data = NULL;
+		pr->mmap_len = 0;
+		pr->mmap_skip = 0;
+	}
+	pr->flags &= ~BLKID_FL_MMAP_FAILED;
+}
+
+/**
+ * blkid_probe_enable_mmap:
+ * @pr: probe
+ * @enable: TRUE/FALSE
+ *
+ * Enables/disables memory mapping of regular files. The probing functions
+ * then get pointers directly into the mapped file rather than to copies of
+ * the data. Block devices and files shorter than the probing area are read
+ * as usual. Note that the file must not be truncated while it is probed.
+ *
+ * Mapping is disabled by default.
+ *
+ * Returns: 0 on success, or -1 in case of error.
+ */
+int blkid_probe_enable_mmap(blkid_probe pr, int enable)
+{
+	if (!pr)
+		return -1;
+
+	if (enable)
+		pr->flags |= BLKID_FL_MMAP;
+	else {
+		blkid_probe_unmap(pr);
+		pr->flags &= ~BLKID_FL_MMAP;
+	}
+	return 0;
+}
+
+/*
+ * Reads @len bytes at @off (from the begin of the probing area) into the
+ * matching part of @bf.
+ */
+static int blkid_probe_read(blkid_probe pr, struct blkid_bufinfo *bf,
+			    blkid_loff_t off, blkid_loff_t len)
+{
+	unsigned char *data = bf->data + (off - bf->off);
+	ssize_t ret;
+
+	DBG(LOWPROBE, ul_debug("\tbuffer read: off=%jd len=%jd pr=%p",
+			off, len, pr));
+
+	do {
+		ret = pread(pr->fd, data, len, pr->off + off);
+	} while (ret < 0 && errno == EINTR);
+
+	pr->io_reads++;
+	if (ret > 0)
+		pr->io_bytes += ret;
+
+	if (ret != (ssize_t) len) {
+		DBG(LOWPROBE, ul_debug("\tbuffer read: return %zd error %m", ret));
+		if (ret >= 0)
+			errno = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Copies the part of [off, off + len) that is already cached into @bf and
+ * reads the gaps from the device. The buffers list is sorted by offset.
+ */
+static int blkid_probe_fill_buffer(blkid_probe pr, struct blkid_bufinfo *bf)
+{
+	struct list_head *p;
+	blkid_loff_t cur = bf->off, end = bf->off + bf->len;
+
+	list_for_each(p, &pr->buffers) {
+		struct blkid_bufinfo *x =
+				list_entry(p, struct blkid_bufinfo, bufs);
+		blkid_loff_t x_end = x->off + x->len;
+
+		if (x->off >= end)
+			break;
+		if (x_end <= cur)
+			continue;
+		if (x->off > cur) {
+			if (blkid_probe_read(pr, bf, cur, x->off - cur))
+				return -1;
+			cur = x->off;
+		}
+		x_end = min(x_end, end);
+		memcpy(bf->data + (cur - bf->off), x->data + (cur - x->off),
+				x_end - cur);
+		cur = x_end;
+	}
+
+	if (cur < end)
+		return blkid_probe_read(pr, bf, cur, end - cur);
+	return 0;
+}
+
+static struct blkid_bufinfo *blkid_probe_new_buffer(blkid_probe pr,
+				blkid_loff_t off, blkid_loff_t len)
+{
+	struct blkid_bufinfo *bf;
+	struct list_head *p;
+
+	/* someone trying to overflow some buffers? */
+	if (len > ULONG_MAX - sizeof(struct blkid_bufinfo)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	/* allocate info and space for data by why call */
+	bf = calloc(1, sizeof(struct blkid_bufinfo) + len);
+	if (!bf) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	bf->data = ((unsigned char *) bf) + sizeof(struct blkid_bufinfo);
+	bf->len = len;
+	bf->off = off;
+	INIT_LIST_HEAD(&bf->bufs);
+
+	if (blkid_probe_fill_buffer(pr, bf)) {
+		free(bf);
+		return NULL;
+	}
+
+	/* keep the list sorted by offset */
+	list_for_each(p, &pr->buffers) {
+		struct blkid_bufinfo *x =
+				list_entry(p, struct blkid_bufinfo, bufs);
+		if (x->off > off)
+			break;
+	}
+	list_add_tail(&bf->bufs, p);
+	return bf;
+}
+
 unsigned char *blkid_probe_get_buffer(blkid_probe pr,
 				blkid_loff_t off, blkid_loff_t len)
 {
 	struct list_head *p;
 	struct blkid_bufinfo *bf = NULL;
+	blkid_loff_t start;
+	int sequential = 0;
 
 	if (pr->size <= 0) {
 		errno = EINVAL;
@@ -561,59 +747,81 @@ unsigned char *blkid_probe_get_buffer(blkid_probe pr,
 				pr->off + off - pr->parent->off, len);
 	}
 
+	if (off < 0 || len <= 0) {
+		errno = 0;
+		return NULL;
+	}
+
+	if ((pr->flags & BLKID_FL_MMAP) && !pr->mmap_data &&
+	    !(pr->flags & BLKID_FL_MMAP_FAILED) && blkid_probe_map(pr))
+		pr->flags |= BLKID_FL_MMAP_FAILED;
+
+	if (pr->mmap_data) {
+		errno = 0;
+		if (off + len > pr->size)
+			return NULL;
+		return pr->mmap_data + pr->mmap_skip + off;
+	}
+
+	start = off & ~(BLKID_PROBE_READ_ALIGN - 1);
+
 	list_for_each(p, &pr->buffers) {
 		struct blkid_bufinfo *x =
 				list_entry(p, struct blkid_bufinfo, bufs);
 
-		if (x->off <= off && off + len <= x->off + x->len) {
+		if (x->off > off)
+			break;
+		if (off + len <= x->off + x->len) {
 			DBG(LOWPROBE, ul_debug("\treuse buffer: off=%jd len=%jd pr=%p",
 							x->off, x->len, pr));
 			bf = x;
 			break;
 		}
+		if (x->off + x->len >= start)
+			sequential = 1;
+	}
+	if (!bf && off + len <= pr->size) {
+		/* read whole aligned blocks, neighbouring requests are likely */
+		blkid_loff_t end = (off + len + BLKID_PROBE_READ_ALIGN - 1) &
+					~(BLKID_PROBE_READ_ALIGN - 1);
+
+		/* somebody scans the device, read ahead */
+		if (sequential)
+			end = max(end, start + BLKID_PROBE_READAHEAD);
+		end = min(end, pr->size);
+		bf = blkid_probe_new_buffer(pr, start, end - start);
 	}
 	if (!bf) {
-		ssize_t ret;
-
-		if (blkid_llseek(pr->fd, pr->off + off, SEEK_SET) < 0) {
-			errno = 0;
+		/* past the end of the device or the enlarged read failed */
+		bf = blkid_probe_new_buffer(pr, off, len);
+		if (!bf)
 			return NULL;
-		}
-
-		/* someone trying to overflow some buffers? */
-		if (len > ULONG_MAX - sizeof(struct blkid_bufinfo)) {
-			errno = ENOMEM;
-			return NULL;
-		}
+	}
 
-		/* allocate info and space for data by why call */
-		bf = calloc(1, sizeof(struct blkid_bufinfo) + len);
-		if (!bf) {
-			errno = ENOMEM;
-			return NULL;
-		}
+	errno = 0;
+	return bf->data + (off - bf->off);
+}
 
-		bf->data = ((unsigned char *) bf) + sizeof(struct blkid_bufinfo);
-		bf->len = len;
-		bf->off = off;
-		INIT_LIST_HEAD(&bf->bufs);
+/*
+ * Reads the first and the last BLKID_PROBE_PREFETCH bytes of the device.
+ * That's where nearly all superblocks and partition tables (incl. the GPT
+ * backup header) are, so most probing functions don't need any more I/O.
+ */
+void blkid_probe_prefetch(blkid_probe pr)
+{
+	blkid_loff_t len;
 
-		DBG(LOWPROBE, ul_debug("\tbuffer read: off=%jd len=%jd pr=%p",
-				off, len, pr));
+	if (pr->size <= 0 || (pr->flags & BLKID_FL_NOSCAN_DEV))
+		return;
 
-		ret = read(pr->fd, bf->data, len);
-		if (ret != (ssize_t) len) {
-			DBG(LOWPROBE, ul_debug("\tbuffer read: return %zd error %m", ret));
-			free(bf);
-			if (ret >= 0)
-				errno = 0;
-			return NULL;
-		}
-		list_add_tail(&bf->bufs, &pr->buffers);
-	}
+	len = min(pr->size, (blkid_loff_t) BLKID_PROBE_PREFETCH);
 
+	if (!blkid_probe_get_buffer(pr, 0, len))
+		DBG(LOWPROBE, ul_debug("\tprefetch of the first %jd bytes failed", len));
+	if (pr->size > len &&
+	    !blkid_probe_get_buffer(pr, pr->size - len, len))
+		DBG(LOWPROBE, ul_debug("\tprefetch of the last %jd bytes failed", len));
 	errno = 0;
-	return off ? bf->data + (off - bf->off) : bf->data;
 }
 
 
@@ -636,8 +844,9 @@ static void blkid_probe_reset_buffer(blkid_probe pr)
 	}
 
 	DBG(LOWPROBE, ul_debug("buffers summary: %"PRIu64" bytes "
-			"by %"PRIu64" read() call(s)",
-			len_ct, read_ct));
+			"in %"PRIu64" buffer(s), %"PRIu64" bytes "
+			"by %"PRIu64" read() call(s) in total",
+			len_ct, read_ct, pr->io_bytes, pr->io_reads));
 
 	INIT_LIST_HEAD(&pr->buffers);
 }
@@ -680,6 +889,7 @@ int blkid_probe_set_device(blkid_probe pr, int fd,
 
 	blkid_reset_probe(pr);
 	blkid_probe_reset_buffer(pr);
+	blkid_probe_unmap(pr);
 
 	if ((pr->flags & BLKID_FL_PRIVATE_FD) && pr->fd >= 0)
 		close(pr->fd);
@@ -798,6 +1008,7 @@ int blkid_probe_set_dimension(blkid_probe pr,
 		pr->flags |= BLKID_FL_TINY_DEV;
 
 	blkid_probe_reset_buffer(pr);
+	blkid_probe_unmap(pr);
 
 	return 0;
 }
@@ -854,6 +1065,7 @@ static inline void blkid_probe_start(blkid_probe pr)
 		pr->cur_chain = NULL;
 		pr->prob_flags = 0;
 		blkid_probe_set_wiper(pr, 0, 0);
+		blkid_probe_prefetch(pr);
 	}
 }
 
@@ -1052,6 +1264,8 @@ int blkid_do_wipe(blkid_probe pr, int dryrun)
 		if (write_all(fd, buf, len))
 			return -1;
 		fsync(fd);
+		/* privately modified pages would hide the wiped area */
+		blkid_probe_unmap(pr);
 		return blkid_probe_step_back(pr);
 	}
 
@@ -1263,6 +1477,50 @@ done:
 	return count ? 0 : 1;
 }
 
+/**
+ * blkid_do_typeprobe:
+ * @pr: prober
+ *
+ * This is a light-weight blkid_do_fullprobe() for callers which are
+ * interested in the filesystem or raid type only. The function probes for
+ * superblocks only, ignores the superblocks flags and the partitions and
+ * topology chains setup, defines TYPE and USAGE values only and stops at
+ * the first detected superblock. Filters are still applied.
+ *
+ * Returns: 0 on success, 1 if nothing is detected or -1 on case of error.
+ */
+int blkid_do_typeprobe(blkid_probe pr)
+{
+	struct blkid_chain *chn;
+	int flags, rc;
+
+	if (!pr)
+		return -1;
+	if (pr->flags & BLKID_FL_NOSCAN_DEV)
+		return 1;
+
+	blkid_probe_start(pr);
+
+	chn = pr->cur_chain = &pr->chains[BLKID_CHAIN_SUBLKS];
+	chn->binary = FALSE;
+
+	flags = chn->flags;
+	chn->flags = BLKID_SUBLKS_TYPE | BLKID_SUBLKS_USAGE;
+
+	DBG(LOWPROBE, ul_debug("chain typeprobe %s", chn->driver->name));
+
+	blkid_probe_chain_reset_position(chn);
+	rc = chn->driver->probe(pr, chn);
+	blkid_probe_chain_reset_position(chn);
+
+	chn->flags = flags;
+	blkid_probe_end(pr);
+
+	if (rc < 0)
+		return rc;
+	return rc == 0 ? 0 : 1;
+}
+
 /* same sa blkid_probe_get_buffer() but works with 512-sectors */
 unsigned char *blkid_probe_get_sector(blkid_probe pr, unsigned int sector)
 {
@@ -45,7 +45,7 @@ static void debug_dump_dev(blkid_dev dev);
 #endif
 
 /*
- * File format:
+ * Text file format (see bincache.c for the binary format):
  *
  *	<device [<NAME="value"> ...]>device_name</device>
  *
@@ -399,7 +399,7 @@ void blkid_read_cache(blkid_cache cache)
 {
 	FILE *file;
 	char buf[4096];
-	int fd, lineno = 0;
+	int fd, rc, lineno = 0;
 	struct stat st;
 
 	if (!cache)
@@ -423,6 +423,15 @@ void blkid_read_cache(blkid_cache cache)
 	DBG(CACHE, ul_debug("reading cache file %s",
 				cache->bic_filename));
 
+	/* binary file is only mapped, see bincache.c */
+	rc = blkid_bincache_map(cache, fd, &st);
+	if (rc > 0) {
+		cache->bic_flags &= ~BLKID_BIC_FL_CHANGED;
+		cache->bic_ftime = st.st_mtime;
+	}
+	if (rc != 0)
+		goto errout;
+
 	file = fdopen(fd, "r" UL_CLOEXECSTR);
 	if (!file)
 		goto errout;
@@ -94,6 +94,8 @@ int blkid_flush_cache(blkid_cache cache)
 		return 0;
 	}
 
+	blkid_bincache_load(cache);
+
 	filename = cache->bic_filename ? cache->bic_filename :
 					 blkid_get_cache_filename(NULL);
 	if (!filename)
@@ -124,12 +126,12 @@ int blkid_flush_cache(blkid_cache cache)
 
 	/*
 	 * Try and create a temporary file in the same directory so
-	 * that in case of error we don't overwrite the cache file.
-	 * If the cache file doesn't yet exist, it isn't a regular
-	 * file (e.g. /dev/null or a socket), or we couldn't create
-	 * a temporary file then we open it directly.
+	 * that in case of error we don't overwrite the cache file and
+	 * readers never see a partially written file. If the cache file
+	 * isn't a regular file (e.g. /dev/null or a socket), or we
+	 * couldn't create a temporary file then we open it directly.
 	 */
-	if (ret == 0 && S_ISREG(st.st_mode)) {
+	if (ret < 0 || S_ISREG(st.st_mode)) {
 		tmp = malloc(strlen(filename) + 8);
 		if (tmp) {
 			sprintf(tmp, "%s-XXXXXX", filename);
@@ -158,13 +160,17 @@ int blkid_flush_cache(blkid_cache cache)
 		goto errout;
 	}
 
-	list_for_each(p, &cache->bic_devs) {
-		blkid_dev dev = list_entry(p, struct blkid_struct_dev, bid_devs);
-		if (!dev->bid_type || (dev->bid_flags & BLKID_BID_FL_REMOVABLE))
-			continue;
-		if ((ret = save_dev(dev, file)) < 0)
-			break;
-	}
+	ret = 0;
+	if (cache->bic_flags & BLKID_BIC_FL_TEXT) {
+		list_for_each(p, &cache->bic_devs) {
+			blkid_dev dev = list_entry(p, struct blkid_struct_dev, bid_devs);
+			if (!dev->bid_type || (dev->bid_flags & BLKID_BID_FL_REMOVABLE))
+				continue;
+			if ((ret = save_dev(dev, file)) < 0)
+				break;
+		}
+	} else
+		ret = blkid_bincache_save(cache, file);
 
 	if (ret >= 0) {
 		cache->bic_flags &= ~BLKID_BIC_FL_CHANGED;
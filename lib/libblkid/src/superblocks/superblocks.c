@@ -330,6 +330,157 @@ int blkid_superblocks_get_name(size_t idx, const char **name, int *usage)
 	return -1;
 }
 
+/*
+ * Magic strings of all idinfos[] sorted by the 1KiB window they are read
+ * from. This allows to read and compare every window only once per probing
+ * run rather than once for every idinfo.
+ */
+struct sb_magref {
+	blkid_loff_t	off;		/* window offset */
+	unsigned short	id;		/* index in idinfos[] */
+	unsigned short	mag;		/* index in idinfos[id]->magics[] */
+};
+
+#define SB_MAX_MAGREFS	256
+
+enum {
+	SB_MAGREFS_NONE = 0,
+	SB_MAGREFS_BUILDING,
+	SB_MAGREFS_READY,
+	SB_MAGREFS_FAILED
+};
+
+static struct sb_magref sb_magrefs[SB_MAX_MAGREFS];
+static size_t sb_nmagrefs;
+static int sb_magrefs_state;
+
+static int cmp_magref(const void *a, const void *b)
+{
+	const struct sb_magref *ra = a, *rb = b;
+
+	if (ra->off != rb->off)
+		return ra->off < rb->off ? -1 : 1;
+	if (ra->id != rb->id)
+		return ra->id - rb->id;
+	return ra->mag - rb->mag;
+}
+
+/*
+ * Returns 1 when the index is usable. The first caller builds it, concurrent
+ * callers fall back to the per-idinfo magic lookup meanwhile.
+ */
+static int superblocks_init_magrefs(void)
+{
+	size_t i, n = 0;
+	int state = sb_magrefs_state;
+
+	__sync_synchronize();
+	if (state == SB_MAGREFS_READY)
+		return 1;
+	if (state != SB_MAGREFS_NONE ||
+	    !__sync_bool_compare_and_swap(&sb_magrefs_state,
+				SB_MAGREFS_NONE, SB_MAGREFS_BUILDING))
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(idinfos); i++) {
+		const struct blkid_idmag *mag = idinfos[i]->magics;
+		unsigned short m;
+
+		for (m = 0; mag[m].magic; m++) {
+			if (n == SB_MAX_MAGREFS) {
+				sb_magrefs_state = SB_MAGREFS_FAILED;
+				return 0;
+			}
+			sb_magrefs[n].off = (mag[m].kboff + (mag[m].sboff >> 10)) << 10;
+			sb_magrefs[n].id = i;
+			sb_magrefs[n].mag = m;
+			n++;
+		}
+	}
+
+	qsort(sb_magrefs, n, sizeof(struct sb_magref), cmp_magref);
+	sb_nmagrefs = n;
+
+	DBG(LOWPROBE, ul_debug("superblocks magic index: %zu magics", n));
+
+	__sync_synchronize();
+	sb_magrefs_state = SB_MAGREFS_READY;
+	return 1;
+}
+
+/*
+ * Returns 1 if the idinfo should not be probed on this device.
+ */
+static int superblocks_skip_id(blkid_probe pr, struct blkid_chain *chn,
+			       size_t i)
+{
+	const struct blkid_idinfo *id = idinfos[i];
+
+	if (chn->fltr && blkid_bmp_get_item(chn->fltr, i))
+		return 1;
+
+	/* the device is too small */
+	if (id->minsz && id->minsz > pr->size)
+		return 1;
+
+	/* don't probe for RAIDs, swap or journal on CD/DVDs */
+	if ((id->usage & (BLKID_USAGE_RAID | BLKID_USAGE_OTHER)) &&
+	    blkid_probe_is_cdrom(pr))
+		return 1;
+
+	/* don't probe for RAIDs on floppies */
+	if ((id->usage & BLKID_USAGE_RAID) && blkid_probe_is_tiny(pr))
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Compares all magics of idinfos[start..] window by window. For every idinfo
+ * @mags gets the index of its first matching magic (or -1) and @errs the
+ * read error of a window without a match.
+ */
+static void superblocks_match_magics(blkid_probe pr, struct blkid_chain *chn,
+				     size_t start, int *mags, int *errs)
+{
+	size_t i = 0;
+
+	while (i < sb_nmagrefs) {
+		blkid_loff_t off = sb_magrefs[i].off;
+		unsigned char *buf = NULL;
+		int loaded = 0, err = 0;
+
+		for ( ; i < sb_nmagrefs && sb_magrefs[i].off == off; i++) {
+			const struct sb_magref *ref = &sb_magrefs[i];
+			const struct blkid_idmag *mag;
+
+			if (ref->id < start)
+				continue;
+			/* an earlier magic of this idinfo matched already */
+			if (mags[ref->id] >= 0 && mags[ref->id] < ref->mag)
+				continue;
+			if (superblocks_skip_id(pr, chn, ref->id))
+				continue;
+
+			if (!loaded) {
+				buf = blkid_probe_get_buffer(pr, off, 1024);
+				if (!buf && errno)
+					err = -errno;
+				loaded = 1;
+			}
+			if (!buf) {
+				if (!errs[ref->id])
+					errs[ref->id] = err;
+				continue;
+			}
+
+			mag = &idinfos[ref->id]->magics[ref->mag];
+			if (!memcmp(mag->magic, buf + (mag->sboff & 0x3ff), mag->len))
+				mags[ref->id] = ref->mag;
+		}
+	}
+}
+
 /*
  * The blkid_do_probe() backend.
  */
@@ -337,6 +488,9 @@ static int superblocks_probe(blkid_probe pr, struct blkid_chain *chn)
 {
 	size_t i;
 	int rc = BLKID_PROBE_NONE;
+	int indexed;
+	int mags[ARRAY_SIZE(idinfos)];
+	int errs[ARRAY_SIZE(idinfos)];
 
 	if (!pr || chn->idx < -1)
 		return -EINVAL;
@@ -357,6 +511,13 @@ static int superblocks_probe(blkid_probe pr, struct blkid_chain *chn)
 
 	i = chn->idx < 0 ? 0 : chn->idx + 1U;
 
+	indexed = superblocks_init_magrefs();
+	if (indexed) {
+		memset(mags, 0xff, sizeof(mags));
+		memset(errs, 0, sizeof(errs));
+		superblocks_match_magics(pr, chn, i, mags, errs);
+	}
+
 	for ( ; i < ARRAY_SIZE(idinfos); i++) {
 		const struct blkid_idinfo *id;
 		const struct blkid_idmag *mag = NULL;
@@ -365,37 +526,34 @@ static int superblocks_probe(blkid_probe pr, struct blkid_chain *chn)
 		chn->idx = i;
 		id = idinfos[i];
 
-		if (chn->fltr && blkid_bmp_get_item(chn->fltr, i)) {
-			DBG(LOWPROBE, ul_debug("filter out: %s", id->name));
-			rc = BLKID_PROBE_NONE;
-			continue;
-		}
-
-		if (id->minsz && id->minsz > pr->size) {
-			rc = BLKID_PROBE_NONE;
-			continue;	/* the device is too small */
-		}
-
-		/* don't probe for RAIDs, swap or journal on CD/DVDs */
-		if ((id->usage & (BLKID_USAGE_RAID | BLKID_USAGE_OTHER)) &&
-		    blkid_probe_is_cdrom(pr)) {
-			rc = BLKID_PROBE_NONE;
-			continue;
-		}
-
-		/* don't probe for RAIDs on floppies */
-		if ((id->usage & BLKID_USAGE_RAID) && blkid_probe_is_tiny(pr)) {
+		if (superblocks_skip_id(pr, chn, i)) {
+			DBG(LOWPROBE, ul_debug("skip: %s", id->name));
 			rc = BLKID_PROBE_NONE;
 			continue;
 		}
 
 		DBG(LOWPROBE, ul_debug("[%zd] %s:", i, id->name));
 
-		rc = blkid_probe_get_idmag(pr, id, &off, &mag);
-		if (rc < 0)
-			break;
-		if (rc != BLKID_PROBE_OK)
-			continue;
+		if (!indexed) {
+			rc = blkid_probe_get_idmag(pr, id, &off, &mag);
+			if (rc < 0)
+				break;
+			if (rc != BLKID_PROBE_OK)
+				continue;
+		} else if (id->magics[0].magic) {
+			if (mags[i] < 0) {
+				rc = errs[i] ? errs[i] : BLKID_PROBE_NONE;
+				if (rc < 0)
+					break;
+				continue;
+			}
+			mag = &id->magics[mags[i]];
+			off = ((mag->kboff + (mag->sboff >> 10)) << 10) +
+				(mag->sboff & 0x3ff);
+			DBG(LOWPROBE, ul_debug("\tmagic sboff=%u, kboff=%ld",
+				mag->sboff, mag->kboff));
+		}
+		rc = BLKID_PROBE_OK;
 
 		/* final check by probing function */
 		if (id->probefunc) {
@@ -284,6 +284,8 @@ static int probe_vfat(blkid_probe pr, const struct blkid_idmag *mag)
 	uint16_t sector_size = 0, reserved;
 	uint32_t cluster_count, fat_size;
 	const char *version = NULL;
+	struct blkid_chain *chn = blkid_probe_get_chain(pr);
+	int want_label = chn && (chn->flags & BLKID_SUBLKS_LABEL);
 
 	ms = blkid_probe_get_sb(pr, mag, struct msdos_super_block);
 	if (!ms)
@@ -304,7 +306,10 @@ static int probe_vfat(blkid_probe pr, const struct blkid_idmag *mag)
 		uint32_t root_start = (reserved + fat_size) * sector_size;
 		uint32_t root_dir_entries = unaligned_le16(&vs->vs_dir_entries);
 
-		vol_label = search_fat_label(pr, root_start, root_dir_entries);
+		/* don't read the root directory if nobody wants the label */
+		if (want_label)
+			vol_label = search_fat_label(pr, root_start,
+						     root_dir_entries);
 		if (vol_label) {
 			memcpy(vol_label_buf, vol_label, 11);
 			vol_label = vol_label_buf;
@@ -334,7 +339,7 @@ static int probe_vfat(blkid_probe pr, const struct blkid_idmag *mag)
 					sector_size / sizeof(uint32_t);
 		uint32_t next = le32_to_cpu(vs->vs_root_cluster);
 
-		while (next && next < entries && --maxloop) {
+		while (want_label && next && next < entries && --maxloop) {
 			uint32_t next_sect_off;
 			uint64_t next_off, fat_entry_off;
 			int count;
@@ -26,10 +26,85 @@ static blkid_tag blkid_new_tag(void)
 
 	INIT_LIST_HEAD(&tag->bit_tags);
 	INIT_LIST_HEAD(&tag->bit_names);
+	INIT_LIST_HEAD(&tag->bit_hash);
 
 	return tag;
 }
 
+/* initial number of buckets of the tag index */
+#define BLKID_TAG_HASH_MIN	64
+
+static size_t blkid_tag_hash(blkid_cache cache, const char *name,
+			     const char *value)
+{
+	const unsigned char *p;
+	uint32_t h = 2166136261U;		/* FNV-1a */
+
+	for (p = (const unsigned char *) name; *p; p++)
+		h = (h ^ *p) * 16777619U;
+	h = (h ^ '=') * 16777619U;
+	for (p = (const unsigned char *) value; *p; p++)
+		h = (h ^ *p) * 16777619U;
+
+	return h & (cache->bic_hashsz - 1);
+}
+
+static int blkid_tag_hash_resize(blkid_cache cache, size_t sz)
+{
+	struct list_head *old = cache->bic_hash;
+	size_t i, oldsz = cache->bic_hashsz;
+
+	cache->bic_hash = malloc(sz * sizeof(struct list_head));
+	if (!cache->bic_hash) {
+		cache->bic_hash = old;
+		return -BLKID_ERR_MEM;
+	}
+	cache->bic_hashsz = sz;
+	for (i = 0; i < sz; i++)
+		INIT_LIST_HEAD(&cache->bic_hash[i]);
+
+	for (i = 0; i < oldsz; i++) {
+		while (!list_empty(&old[i])) {
+			blkid_tag t = list_entry(old[i].next,
+					struct blkid_struct_tag, bit_hash);
+
+			list_del(&t->bit_hash);
+			list_add_tail(&t->bit_hash, &cache->bic_hash[
+				blkid_tag_hash(cache, t->bit_name, t->bit_val)]);
+		}
+	}
+	free(old);
+
+	DBG(TAG, ul_debug("tag index resized to %zu buckets", sz));
+	return 0;
+}
+
+/*
+ * Add the tag to the index of tags of the cache. The index keeps load
+ * factor under 1, so the lookup by NAME and VALUE is O(1).
+ */
+static int blkid_tag_hash_add(blkid_cache cache, blkid_tag t)
+{
+	if (cache->bic_nhashed >= cache->bic_hashsz &&
+	    blkid_tag_hash_resize(cache, cache->bic_hashsz ?
+			cache->bic_hashsz * 2 : BLKID_TAG_HASH_MIN) != 0 &&
+	    !cache->bic_hashsz)
+		return -BLKID_ERR_MEM;
+
+	list_add_tail(&t->bit_hash,
+		&cache->bic_hash[blkid_tag_hash(cache, t->bit_name, t->bit_val)]);
+	cache->bic_nhashed++;
+	return 0;
+}
+
+static void blkid_tag_hash_del(blkid_tag t)
+{
+	if (list_empty(&t->bit_hash))
+		return;
+	list_del_init(&t->bit_hash);
+	t->bit_dev->bid_cache->bic_nhashed--;
+}
+
 void blkid_debug_dump_tag(blkid_tag tag)
 {
 	if (!tag) {
@@ -49,6 +124,7 @@ void blkid_free_tag(blkid_tag tag)
 		   tag->bit_val ? tag->bit_val : "(NULL)"));
 	DBG(TAG, blkid_debug_dump_tag(tag));
 
+	blkid_tag_hash_del(tag);	/* index of tags in the cache */
 	list_del(&tag->bit_tags);	/* list of tags for this device */
 	list_del(&tag->bit_names);	/* list of tags with this type */
 
@@ -155,8 +231,11 @@ int blkid_set_tag(blkid_dev dev, const char *name,
 			free(val);
 			return 0;
 		}
+		blkid_tag_hash_del(t);
 		free(t->bit_val);
 		t->bit_val = val;
+		if (dev->bid_cache)
+			blkid_tag_hash_add(dev->bid_cache, t);
 	} else {
 		/* Existing tag not present, add to device */
 		if (!(t = blkid_new_tag()))
@@ -183,6 +262,10 @@ int blkid_set_tag(blkid_dev dev, const char *name,
 					      &dev->bid_cache->bic_tags);
 			}
 			list_add_tail(&t->bit_names, &head->bit_names);
+			if (blkid_tag_hash_add(dev->bid_cache, t) != 0) {
+				head = NULL;
+				goto errout;
+			}
 		}
 	}
 
@@ -337,7 +420,6 @@ blkid_dev blkid_find_dev_with_tag(blkid_cache cache,
 					 const char *type,
 					 const char *value)
 {
-	blkid_tag	head;
 	blkid_dev	dev;
 	int		pri;
 	struct list_head *p;
@@ -350,17 +432,21 @@ blkid_dev blkid_find_dev_with_tag(blkid_cache cache,
 
 	DBG(TAG, ul_debug("looking for %s=%s in cache", type, value));
 
+	/* try the index of the binary cache file before importing it */
+	blkid_bincache_find(cache, type, value);
+
 try_again:
 	pri = -1;
 	dev = 0;
-	head = blkid_find_head_cache(cache, type);
 
-	if (head) {
-		list_for_each(p, &head->bit_names) {
+	if (cache->bic_hashsz) {
+		list_for_each(p, &cache->bic_hash[
+				blkid_tag_hash(cache, type, value)]) {
 			blkid_tag tmp = list_entry(p, struct blkid_struct_tag,
-						   bit_names);
+						   bit_hash);
 
-			if (!strcmp(tmp->bit_val, value) &&
+			if (!strcmp(tmp->bit_name, type) &&
+			    !strcmp(tmp->bit_val, value) &&
 			    (tmp->bit_dev->bid_pri > pri) &&
 			    !access(tmp->bit_dev->bid_name, F_OK)) {
 				dev = tmp->bit_dev;
@@ -374,6 +460,11 @@ try_again:
 			goto try_again;
 	}
 
+	if (!dev && cache->bic_map) {
+		blkid_bincache_load(cache);
+		goto try_again;
+	}
+
 	if (!dev && !probe_new) {
 		if (blkid_probe_all_new(cache) < 0)
 			return NULL;
@@ -397,15 +488,79 @@ extern char *optarg;
 extern int optind;
 #endif
 
+#include <time.h>
+
 void __attribute__((__noreturn__)) usage(char *prog)
 {
 	fprintf(stderr, "Usage: %s [-f blkid_file] [-m debug_mask] device "
 		"[type value]\n",
 		prog);
 	fprintf(stderr, "\tList all tags for a device and exit\n");
+	fprintf(stderr, "       %s [-f blkid_file] -n count\n", prog);
+	fprintf(stderr, "\tBenchmark LABEL= lookups in cache with <count> "
+		"devices\n");
 	exit(1);
 }
 
+/*
+ * Adds @count synthetic devices (all of them backed by one temporary file)
+ * to the cache and looks up every one of them by LABEL.
+ */
+static int benchmark(blkid_cache cache, int count)
+{
+	char name[] = "/tmp/blkid-tag-XXXXXX";
+	char buf[64];
+	struct timespec start, end;
+	time_t now = time(0);
+	double ns;
+	int i, fd, rc = 0;
+
+	fd = mkstemp(name);
+	if (fd < 0)
+		return 1;
+	close(fd);
+
+	for (i = 0; i < count; i++) {
+		blkid_dev dev = blkid_new_dev();
+
+		if (!dev || !(dev->bid_name = strdup(name))) {
+			blkid_free_dev(dev);
+			rc = 1;
+			goto done;
+		}
+		dev->bid_cache = cache;
+		dev->bid_time = now;
+		dev->bid_flags |= BLKID_BID_FL_VERIFIED;
+		list_add_tail(&dev->bid_devs, &cache->bic_devs);
+
+		snprintf(buf, sizeof(buf), "label%d", i);
+		blkid_set_tag(dev, "LABEL", buf, strlen(buf));
+		snprintf(buf, sizeof(buf), "%08x-0000-0000-0000-000000000000", i);
+		blkid_set_tag(dev, "UUID", buf, strlen(buf));
+		snprintf(buf, sizeof(buf), "part%d", i);
+		blkid_set_tag(dev, "PARTLABEL", buf, strlen(buf));
+		blkid_set_tag(dev, "TYPE", "ext4", 4);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < count; i++) {
+		snprintf(buf, sizeof(buf), "label%d", i);
+		if (!blkid_find_dev_with_tag(cache, "LABEL", buf)) {
+			fprintf(stderr, "LABEL=%s not found\n", buf);
+			rc = 1;
+			goto done;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+	printf("%d devices: %d lookups in %.3f ms, %.0f ns per lookup\n",
+		count, count, ns / 1e6, ns / count);
+done:
+	unlink(name);
+	return rc;
+}
+
 int main(int argc, char **argv)
 {
 	blkid_tag_iterate	iter;
@@ -419,12 +574,16 @@ int main(int argc, char **argv)
 	char			*search_type = NULL;
 	char			*search_value = NULL;
 	const char		*type, *value;
+	int			count = 0;
 
-	while ((c = getopt (argc, argv, "m:f:")) != EOF)
+	while ((c = getopt (argc, argv, "m:f:n:")) != EOF)
 		switch (c) {
 		case 'f':
 			file = optarg;
 			break;
+		case 'n':
+			count = strtol(optarg, NULL, 10);
+			break;
 		case 'm':
 		{
 			int mask = strtoul (optarg, &tmp, 0);
@@ -439,6 +598,14 @@ int main(int argc, char **argv)
 		case '?':
 			usage(argv[0]);
 		}
+	if (count > 0) {
+		if ((ret = blkid_get_cache(&cache, file ? file : "/dev/null")) != 0)
+			exit(1);
+		ret = benchmark(cache, count);
+		blkid_put_cache(cache);
+		return ret;
+	}
+
 	if (argc > optind)
 		devname = argv[optind++];
 	if (argc > optind)
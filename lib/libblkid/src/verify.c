@@ -13,6 +13,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <pthread.h>
 #ifdef HAVE_SYS_STAT_H
 #include <sys/stat.h>
 #endif
@@ -22,6 +23,7 @@
 
 #include "blkidP.h"
 #include "sysfs.h"
+#include "env.h"
 
 static void blkid_probe_to_tags(blkid_probe pr, blkid_dev dev)
 {
@@ -49,81 +51,109 @@ static void blkid_probe_to_tags(blkid_probe pr, blkid_dev dev)
 	}
 }
 
+/* results of verify_dev_probe() */
+enum {
+	BLKID_VERIFY_FRESH = 0,		/* cached data are recent enough */
+	BLKID_VERIFY_UNVERIFIED,	/* not accessible, keep cached data */
+	BLKID_VERIFY_INVALID,		/* device has to be removed from cache */
+	BLKID_VERIFY_PROBED,		/* probing results are in the probe */
+	BLKID_VERIFY_STALE		/* device has to be probed */
+};
+
+static int verify_errno(void)
+{
+	if ((errno == EPERM) || (errno == EACCES) || (errno == ENOENT))
+		return BLKID_VERIFY_UNVERIFIED;
+	return BLKID_VERIFY_INVALID;
+}
+
 /*
- * Verify that the data in dev is consistent with what is on the actual
- * block device (using the devname field only).  Normally this will be
- * called when finding items in the cache, but for long running processes
- * is also desirable to revalidate an item before use.
- *
- * If we are unable to revalidate the data, we return the old data and
- * do not set the BLKID_BID_FL_VERIFIED flag on it.
+ * Checks whether @dev is stale, returns BLKID_VERIFY_STALE if the device
+ * has to be probed.
  */
-blkid_dev blkid_verify(blkid_cache cache, blkid_dev dev)
+static int verify_dev_check(blkid_dev dev, struct stat *st)
 {
-	blkid_tag_iterate iter;
-	const char *type, *value;
-	struct stat st;
 	time_t diff, now;
-	int fd;
-
-	if (!dev || !cache)
-		return NULL;
 
 	now = time(0);
 	diff = now - dev->bid_time;
 
-	if (stat(dev->bid_name, &st) < 0) {
+	if (stat(dev->bid_name, st) < 0) {
 		DBG(PROBE, ul_debug("blkid_verify: error %m (%d) while "
 			   "trying to stat %s", errno,
 			   dev->bid_name));
-	open_err:
-		if ((errno == EPERM) || (errno == EACCES) || (errno == ENOENT)) {
-			/* We don't have read permission, just return cache data. */
-			DBG(PROBE, ul_debug("returning unverified data for %s",
-						dev->bid_name));
-			return dev;
-		}
-		blkid_free_dev(dev);
-		return NULL;
+		return verify_errno();
 	}
 
 	if (now >= dev->bid_time &&
 #ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
-	    (st.st_mtime < dev->bid_time ||
-	        (st.st_mtime == dev->bid_time &&
-		 st.st_mtim.tv_nsec / 1000 <= dev->bid_utime)) &&
+	    (st->st_mtime < dev->bid_time ||
+	        (st->st_mtime == dev->bid_time &&
+		 st->st_mtim.tv_nsec / 1000 <= dev->bid_utime)) &&
 #else
-	    st.st_mtime <= dev->bid_time &&
+	    st->st_mtime <= dev->bid_time &&
 #endif
 	    (diff < BLKID_PROBE_MIN ||
 		(dev->bid_flags & BLKID_BID_FL_VERIFIED &&
 		 diff < BLKID_PROBE_INTERVAL)))
-		return dev;
+		return BLKID_VERIFY_FRESH;
 
 #ifndef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
 	DBG(PROBE, ul_debug("need to revalidate %s (cache time %lu, stat time %lu,\t"
 		   "time since last check %lu)",
 		   dev->bid_name, (unsigned long)dev->bid_time,
-		   (unsigned long)st.st_mtime, (unsigned long)diff));
+		   (unsigned long)st->st_mtime, (unsigned long)diff));
 #else
 	DBG(PROBE, ul_debug("need to revalidate %s (cache time %lu.%lu, stat time %lu.%lu,\t"
 		   "time since last check %lu)",
 		   dev->bid_name,
 		   (unsigned long)dev->bid_time, (unsigned long)dev->bid_utime,
-		   (unsigned long)st.st_mtime, (unsigned long)st.st_mtim.tv_nsec / 1000,
+		   (unsigned long)st->st_mtime, (unsigned long)st->st_mtim.tv_nsec / 1000,
 		   (unsigned long)diff));
 #endif
 
-	if (sysfs_devno_is_lvm_private(st.st_rdev)) {
-		blkid_free_dev(dev);
-		return NULL;
-	}
-	if (!cache->probe) {
-		cache->probe = blkid_new_probe();
-		if (!cache->probe) {
-			blkid_free_dev(dev);
-			return NULL;
-		}
+	if (sysfs_devno_is_lvm_private(st->st_rdev))
+		return BLKID_VERIFY_INVALID;
+	return BLKID_VERIFY_STALE;
+}
+
+/*
+ * Probes for superblocks and partitions by @pr, the device has to be
+ * assigned already.
+ */
+static int verify_probe_run(blkid_probe pr)
+{
+	/* enable superblocks probing */
+	blkid_probe_enable_superblocks(pr, TRUE);
+	blkid_probe_set_superblocks_flags(pr,
+		BLKID_SUBLKS_LABEL | BLKID_SUBLKS_UUID |
+		BLKID_SUBLKS_TYPE | BLKID_SUBLKS_SECTYPE);
+
+	/* enable partitions probing */
+	blkid_probe_enable_partitions(pr, TRUE);
+	blkid_probe_set_partitions_flags(pr, BLKID_PARTS_ENTRY_DETAILS);
+
+	/* probe, found nothing or error means invalid device */
+	return blkid_do_safeprobe(pr) ? BLKID_VERIFY_INVALID : BLKID_VERIFY_PROBED;
+}
+
+/*
+ * Checks whether @dev is stale and if yes, probes the device by @pr (allocated
+ * on demand). This function does not modify the cache, so it's safe to call
+ * it for different devices from more threads at the same time.
+ */
+static int verify_dev_probe(blkid_probe *pr, blkid_dev dev, struct stat *st)
+{
+	int fd, rc;
+
+	rc = verify_dev_check(dev, st);
+	if (rc != BLKID_VERIFY_STALE)
+		return rc;
+
+	if (!*pr) {
+		*pr = blkid_new_probe();
+		if (!*pr)
+			return BLKID_VERIFY_INVALID;
 	}
 
 	fd = open(dev->bid_name, O_RDONLY|O_CLOEXEC);
@@ -131,12 +161,40 @@ blkid_dev blkid_verify(blkid_cache cache, blkid_dev dev)
 		DBG(PROBE, ul_debug("blkid_verify: error %m (%d) while "
 					"opening %s", errno,
 					dev->bid_name));
-		goto open_err;
+		return verify_errno();
 	}
 
-	if (blkid_probe_set_device(cache->probe, fd, 0, 0)) {
+	if (blkid_probe_set_device(*pr, fd, 0, 0)) {
 		/* failed to read the device */
 		close(fd);
+		return BLKID_VERIFY_INVALID;
+	}
+
+	rc = verify_probe_run(*pr);
+
+	/* all results are in memory now */
+	close(fd);
+	return rc;
+}
+
+/*
+ * Applies result of verify_dev_probe() to @dev and the cache.
+ */
+static blkid_dev verify_dev_update(blkid_cache cache, blkid_dev dev,
+				   blkid_probe pr, int rc, struct stat *st)
+{
+	blkid_tag_iterate iter;
+	const char *type, *value;
+
+	switch (rc) {
+	case BLKID_VERIFY_FRESH:
+		return dev;
+	case BLKID_VERIFY_UNVERIFIED:
+		/* We don't have read permission, just return cache data. */
+		DBG(PROBE, ul_debug("returning unverified data for %s",
+					dev->bid_name));
+		return dev;
+	case BLKID_VERIFY_INVALID:
 		blkid_free_dev(dev);
 		return NULL;
 	}
@@ -147,49 +205,266 @@ blkid_dev blkid_verify(blkid_cache cache, blkid_dev dev)
 		blkid_set_tag(dev, type, NULL, 0);
 	blkid_tag_iterate_end(iter);
 
-	/* enable superblocks probing */
-	blkid_probe_enable_superblocks(cache->probe, TRUE);
-	blkid_probe_set_superblocks_flags(cache->probe,
-		BLKID_SUBLKS_LABEL | BLKID_SUBLKS_UUID |
-		BLKID_SUBLKS_TYPE | BLKID_SUBLKS_SECTYPE);
-
-	/* enable partitions probing */
-	blkid_probe_enable_partitions(cache->probe, TRUE);
-	blkid_probe_set_partitions_flags(cache->probe, BLKID_PARTS_ENTRY_DETAILS);
-
-	/* probe */
-	if (blkid_do_safeprobe(cache->probe)) {
-		/* found nothing or error */
-		blkid_free_dev(dev);
-		dev = NULL;
-	}
-
-	if (dev) {
 #ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+	{
 		struct timeval tv;
 		if (!gettimeofday(&tv, NULL)) {
 			dev->bid_time = tv.tv_sec;
 			dev->bid_utime = tv.tv_usec;
 		} else
-#endif
 			dev->bid_time = time(0);
+	}
+#else
+	dev->bid_time = time(0);
+#endif
+	dev->bid_devno = st->st_rdev;
+	dev->bid_flags |= BLKID_BID_FL_VERIFIED;
+	cache->bic_flags |= BLKID_BIC_FL_CHANGED;
 
-		dev->bid_devno = st.st_rdev;
-		dev->bid_flags |= BLKID_BID_FL_VERIFIED;
-		cache->bic_flags |= BLKID_BIC_FL_CHANGED;
+	blkid_probe_to_tags(pr, dev);
 
-		blkid_probe_to_tags(cache->probe, dev);
+	DBG(PROBE, ul_debug("%s: devno 0x%04llx, type %s",
+		   dev->bid_name, (long long)st->st_rdev, dev->bid_type));
+	return dev;
+}
 
-		DBG(PROBE, ul_debug("%s: devno 0x%04llx, type %s",
-			   dev->bid_name, (long long)st.st_rdev, dev->bid_type));
-	}
+static void verify_reset_probe(blkid_probe pr)
+{
+	if (!pr)
+		return;
+	blkid_reset_probe(pr);
+	blkid_probe_reset_superblocks_filter(pr);
+}
 
-	blkid_reset_probe(cache->probe);
-	blkid_probe_reset_superblocks_filter(cache->probe);
-	close(fd);
+/*
+ * Verify that the data in dev is consistent with what is on the actual
+ * block device (using the devname field only).  Normally this will be
+ * called when finding items in the cache, but for long running processes
+ * is also desirable to revalidate an item before use.
+ *
+ * If we are unable to revalidate the data, we return the old data and
+ * do not set the BLKID_BID_FL_VERIFIED flag on it.
+ */
+blkid_dev blkid_verify(blkid_cache cache, blkid_dev dev)
+{
+	struct stat st;
+	int rc;
+
+	if (!dev || !cache)
+		return NULL;
+
+	rc = verify_dev_probe(&cache->probe, dev, &st);
+	dev = verify_dev_update(cache, dev, cache->probe, rc, &st);
+	if (rc != BLKID_VERIFY_FRESH)
+		verify_reset_probe(cache->probe);
 	return dev;
 }
 
+/*
+ * Parallel verification. The devices are distributed among a pool of
+ * threads, every thread uses its own probe and only the update of the
+ * cache is serialized.
+ */
+struct verify_pool {
+	blkid_cache	cache;
+	blkid_dev	*devs;
+	size_t		ndevs;
+	size_t		next;		/* next device to verify */
+	pthread_mutex_t	lock;		/* protects the cache */
+};
+
+static void *verify_worker(void *data)
+{
+	struct verify_pool *vp = (struct verify_pool *) data;
+	blkid_probe pr = NULL;
+
+	for (;;) {
+		size_t i = __sync_fetch_and_add(&vp->next, 1);
+		struct stat st;
+		int rc;
+
+		if (i >= vp->ndevs)
+			break;
+
+		rc = verify_dev_probe(&pr, vp->devs[i], &st);
+
+		pthread_mutex_lock(&vp->lock);
+		verify_dev_update(vp->cache, vp->devs[i], pr, rc, &st);
+		pthread_mutex_unlock(&vp->lock);
+
+		if (rc != BLKID_VERIFY_FRESH)
+			verify_reset_probe(pr);
+	}
+
+	blkid_free_probe(pr);
+	return NULL;
+}
+
+/*
+ * Verification of devices which were never probed. These are cold, so
+ * their superblock areas are read in one wave by blkid_probe_batch() and
+ * only the probing itself runs here, one device after another.
+ */
+struct verify_batch {
+	blkid_cache	cache;
+	blkid_dev	*devs;
+	struct stat	*st;
+	const char	**names;
+	blkid_probe	pr;		/* for devices the batch can't open */
+};
+
+static int verify_batch_probe(blkid_probe pr, const char *devname, void *data)
+{
+	struct verify_batch *vb = (struct verify_batch *) data;
+	size_t i;
+	int rc;
+
+	/* the batch passes our pointers back */
+	for (i = 0; vb->names[i] != devname; i++)
+		;
+
+	if (pr) {
+		rc = verify_probe_run(pr);
+		verify_dev_update(vb->cache, vb->devs[i], pr, rc, &vb->st[i]);
+		return 0;
+	}
+
+	/* open it again here, errno decides whether the device stays */
+	rc = verify_dev_probe(&vb->pr, vb->devs[i], &vb->st[i]);
+	verify_dev_update(vb->cache, vb->devs[i], vb->pr, rc, &vb->st[i]);
+	if (rc != BLKID_VERIFY_FRESH)
+		verify_reset_probe(vb->pr);
+	return 0;
+}
+
+static void verify_devs_batch(blkid_cache cache, blkid_dev *devs, size_t ndevs)
+{
+	struct verify_batch vb;
+	size_t i, n = 0;
+
+	memset(&vb, 0, sizeof(vb));
+	vb.cache = cache;
+	vb.devs = calloc(ndevs, sizeof(blkid_dev));
+	vb.st = calloc(ndevs, sizeof(struct stat));
+	vb.names = calloc(ndevs, sizeof(char *));
+	if (!vb.devs || !vb.st || !vb.names) {
+		for (i = 0; i < ndevs; i++)
+			blkid_verify(cache, devs[i]);
+		goto done;
+	}
+
+	for (i = 0; i < ndevs; i++) {
+		struct stat st;
+		int rc = verify_dev_check(devs[i], &st);
+
+		if (rc != BLKID_VERIFY_STALE) {
+			verify_dev_update(cache, devs[i], NULL, rc, &st);
+			continue;
+		}
+		vb.devs[n] = devs[i];
+		vb.st[n] = st;
+		vb.names[n] = devs[i]->bid_name;
+		n++;
+	}
+
+	DBG(PROBE, ul_debug("probing %zu of %zu new devices in a batch",
+				n, ndevs));
+	if (n)
+		blkid_probe_batch(vb.names, n, verify_batch_probe, &vb);
+	blkid_free_probe(vb.pr);
+done:
+	free(vb.devs);
+	free(vb.st);
+	free(vb.names);
+}
+
+/*
+ * Returns the number of threads for blkid_verify_devs() as configured by
+ * BLKID_PROBE_THREADS environment variable; zero or invalid number means
+ * one thread per online CPU. Returns 0 if the variable is not set.
+ */
+int blkid_verify_threads(void)
+{
+	const char *str = safe_getenv("BLKID_PROBE_THREADS");
+	long n;
+
+	if (!str)
+		return 0;
+
+	n = strtol(str, NULL, 10);
+	if (n <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n <= 0)
+		n = 1;
+	return n > BLKID_VERIFY_THREADS_MAX ? BLKID_VERIFY_THREADS_MAX : n;
+}
+
+/*
+ * Verifies devices in the cache by @nthreads threads. If @pending is
+ * non-zero, only devices marked by BLKID_BID_FL_PENDING are verified,
+ * by one batch instead of the threads, otherwise all devices except the
+ * removable ones.
+ */
+void blkid_verify_devs(blkid_cache cache, int pending, int nthreads)
+{
+	struct verify_pool vp;
+	pthread_t threads[BLKID_VERIFY_THREADS_MAX];
+	struct list_head *p;
+	size_t i, n = 0;
+	int nrun = 0;
+
+	if (!cache)
+		return;
+
+	memset(&vp, 0, sizeof(vp));
+	vp.cache = cache;
+
+	list_for_each(p, &cache->bic_devs)
+		n++;
+	if (!n)
+		return;
+	vp.devs = calloc(n, sizeof(blkid_dev));
+	if (!vp.devs)
+		return;
+
+	list_for_each(p, &cache->bic_devs) {
+		blkid_dev dev = list_entry(p, struct blkid_struct_dev, bid_devs);
+
+		if (pending ? !(dev->bid_flags & BLKID_BID_FL_PENDING) :
+			      (dev->bid_flags & BLKID_BID_FL_REMOVABLE))
+			continue;
+		dev->bid_flags &= ~BLKID_BID_FL_PENDING;
+		vp.devs[vp.ndevs++] = dev;
+	}
+
+	if (pending) {
+		verify_devs_batch(cache, vp.devs, vp.ndevs);
+		free(vp.devs);
+		return;
+	}
+
+	pthread_mutex_init(&vp.lock, NULL);
+
+	if (nthreads > BLKID_VERIFY_THREADS_MAX)
+		nthreads = BLKID_VERIFY_THREADS_MAX;
+	while (nrun < nthreads && (size_t) nrun < vp.ndevs &&
+	       pthread_create(&threads[nrun], NULL, verify_worker, &vp) == 0)
+		nrun++;
+
+	DBG(PROBE, ul_debug("verifying %zu devices by %d threads",
+				vp.ndevs, nrun));
+
+	/* no threads, verify everything here */
+	if (!nrun)
+		verify_worker(&vp);
+
+	for (i = 0; i < (size_t) nrun; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&vp.lock);
+	free(vp.devs);
+}
+
 #ifdef TEST_PROGRAM
 int main(int argc, char **argv)
 {
@@ -0,0 +1,148 @@
+#include <common.h>
+
+/*
+ * Bounded LRU cache for realpath() results.
+ *
+ * Only absolute paths get cached. The whole cache gets flushed whenever a
+ * traced process changes the filesystem layout (symlink, rename, unlink,
+ * mount, ...), so there's no need for per-entry invalidation.
+ */
+
+#define PATH_CACHE_ENTRIES 64
+#define PATH_CACHE_BUCKETS 128
+#define PATH_CACHE_REPORT_INTERVAL 4096
+
+struct path_cache_entry {
+	char *path;
+	char *resolved;
+	uint32_t hash;
+	unsigned long last_used;
+	int next;
+};
+
+static struct path_cache_entry entries[PATH_CACHE_ENTRIES];
+static int buckets[PATH_CACHE_BUCKETS];
+static int num_entries = 0;
+static bool initialized = false;
+
+static unsigned long tick = 0;
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+static unsigned long flushes = 0;
+
+static void path_cache_init(void)
+{
+	unsigned i;
+
+	for (i = 0; i < PATH_CACHE_BUCKETS; i++)
+		buckets[i] = -1;
+
+	initialized = true;
+}
+
+void path_cache_report(void)
+{
+	INFO("path_cache: hits=%lu misses=%lu flushes=%lu entries=%d\n",
+	     hits, misses, flushes, num_entries);
+}
+
+const char *path_cache_lookup(const char *path)
+{
+	uint32_t hash;
+	int i;
+
+	if (!initialized)
+		path_cache_init();
+
+	if (++tick % PATH_CACHE_REPORT_INTERVAL == 0)
+		path_cache_report();
+
+	hash = hash_string(path);
+	for (i = buckets[hash % PATH_CACHE_BUCKETS]; i >= 0;
+	     i = entries[i].next) {
+		if (entries[i].hash == hash && !strcmp(entries[i].path, path)) {
+			entries[i].last_used = tick;
+			hits++;
+			return entries[i].resolved;
+		}
+	}
+
+	misses++;
+	return NULL;
+}
+
+static void path_cache_unlink(int index)
+{
+	int *pos = &buckets[entries[index].hash % PATH_CACHE_BUCKETS];
+
+	while (*pos != index)
+		pos = &entries[*pos].next;
+	*pos = entries[index].next;
+
+	free(entries[index].path);
+	free(entries[index].resolved);
+	entries[index].path = NULL;
+	entries[index].resolved = NULL;
+}
+
+void path_cache_insert(const char *path, const char *resolved)
+{
+	struct path_cache_entry *entry;
+	char *path_copy, *resolved_copy;
+	int i, index;
+
+	if (path[0] != '/')
+		return;
+
+	if (!initialized)
+		path_cache_init();
+
+	path_copy = strdup(path);
+	resolved_copy = strdup(resolved);
+	if (!path_copy || !resolved_copy) {
+		free(path_copy);
+		free(resolved_copy);
+		return;
+	}
+
+	if (num_entries < PATH_CACHE_ENTRIES) {
+		index = num_entries++;
+	} else {
+		// evict least recently used entry
+		index = 0;
+		for (i = 1; i < PATH_CACHE_ENTRIES; i++) {
+			if (entries[i].last_used < entries[index].last_used)
+				index = i;
+		}
+		path_cache_unlink(index);
+	}
+
+	entry = &entries[index];
+	entry->path = path_copy;
+	entry->resolved = resolved_copy;
+	entry->hash = hash_string(path);
+	entry->last_used = tick;
+	entry->next = buckets[entry->hash % PATH_CACHE_BUCKETS];
+	buckets[entry->hash % PATH_CACHE_BUCKETS] = index;
+}
+
+void path_cache_flush(void)
+{
+	int i;
+
+	if (!initialized)
+		return;
+
+	for (i = 0; i < num_entries; i++) {
+		free(entries[i].path);
+		free(entries[i].resolved);
+		entries[i].path = NULL;
+		entries[i].resolved = NULL;
+	}
+
+	for (i = 0; i < PATH_CACHE_BUCKETS; i++)
+		buckets[i] = -1;
+
+	num_entries = 0;
+	flushes++;
+}
@@ -0,0 +1,113 @@
+#include <common.h>
+
+/*
+ * Byte-wise prefix trie.
+ * Children of a node are kept in a singly linked sibling list which is
+ * fine for the few, mostly shared, prefixes we store.
+ */
+
+static int path_trie_new_node(struct path_trie *trie, char c)
+{
+	struct path_trie_node *node;
+
+	if (trie->num_nodes == trie->num_alloc) {
+		int num_alloc = trie->num_alloc ? trie->num_alloc * 2 : 32;
+		node = realloc(trie->nodes, num_alloc * sizeof(node[0]));
+		if (!node)
+			return -1;
+
+		trie->nodes = node;
+		trie->num_alloc = num_alloc;
+	}
+
+	node = &trie->nodes[trie->num_nodes];
+	node->c = c;
+	node->terminal = false;
+	node->child = -1;
+	node->next = -1;
+
+	return trie->num_nodes++;
+}
+
+struct path_trie *path_trie_create(void)
+{
+	struct path_trie *trie = calloc(1, sizeof(struct path_trie));
+	if (!trie)
+		return NULL;
+
+	// root node
+	if (path_trie_new_node(trie, 0) < 0) {
+		free(trie);
+		return NULL;
+	}
+
+	return trie;
+}
+
+void path_trie_free(struct path_trie *trie)
+{
+	free(trie->nodes);
+	free(trie);
+}
+
+int path_trie_add(struct path_trie *trie, const char *prefix)
+{
+	int node = 0;
+
+	for (; *prefix; prefix++) {
+		int child = trie->nodes[node].child;
+
+		while (child >= 0 && trie->nodes[child].c != *prefix)
+			child = trie->nodes[child].next;
+
+		if (child < 0) {
+			child = path_trie_new_node(trie, *prefix);
+			if (child < 0)
+				return -1;
+
+			// nodes may have moved
+			trie->nodes[child].next = trie->nodes[node].child;
+			trie->nodes[node].child = child;
+		}
+
+		node = child;
+	}
+
+	trie->nodes[node].terminal = true;
+	return 0;
+}
+
+/*
+ * Returns true if 'path' starts with one of the prefixes.
+ * 'path' doesn't need to be terminated. If the first 'len' bytes still
+ * match the start of a prefix, the caller needs more data to decide and
+ * we return true as well.
+ */
+bool path_trie_match(const struct path_trie *trie, const char *path,
+		     size_t len)
+{
+	const struct path_trie_node *nodes = trie->nodes;
+	int node = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		int child;
+
+		if (nodes[node].terminal)
+			return true;
+
+		if (path[i] == '\0')
+			return false;
+
+		child = nodes[node].child;
+		while (child >= 0 && nodes[child].c != path[i])
+			child = nodes[child].next;
+
+		if (child < 0)
+			return false;
+
+		node = child;
+	}
+
+	return true;
+}
@@ -1,127 +1,308 @@
 #include <common.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
 
 #define UEVENT_PATH_BLOCK_DEVICES "/sys/class/block"
 
+/* don't bother starting threads for less devices */
+#define UEVENT_THREAD_MIN_DEVICES 16
+#define UEVENT_MAX_THREADS 4
+
+#define UEVENT_NAME_MAX 64
+
+#define UEVENT_MSG_LEN 2048
+#define UEVENT_RCVBUF (256 * 1024)
+
+struct uevent_scan {
+	int dirfd;
+	char (*names)[UEVENT_NAME_MAX];
+	struct sys_block_uevent *entries;
+	int count;
+	int next;
+};
+
 /*
- * Source: http://stackoverflow.com/questions/122616/how-do-i-trim-leading-trailing-whitespace-in-a-standard-way
+ * kernel uevent listener, keeps a sys_block_info up to date after boot.
+ * uevent_lock protects the info while the listener runs
  */
-char *copy_trim(const char *s)
+struct uevent_listener {
+	int sock;
+	bool running;
+	struct sys_block_info *info;
+	const char *dev_path;
+	// bumped whenever info changes
+	unsigned seq;
+};
+
+static struct uevent_listener listener = {.sock = -1 };
+static pthread_mutex_t uevent_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t uevent_cond;
+static pthread_once_t uevent_cond_once = PTHREAD_ONCE_INIT;
+
+static long elapsed_us(const struct timespec *start)
 {
-	int start, end;
-	for (start = 0; s[start] && isspace(s[start]); ++start) {
-	}
-	if (s[start] == '\0')
-		return strdup("");
-	for (end = strlen(s); end > 0 && isspace(s[end - 1]); --end) {
-	}
-	return strndup(s + start, end - start);
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000L +
+	    (now.tv_nsec - start->tv_nsec) / 1000;
 }
 
-int getInt(const char *s)
+static char *trim(char *s, char *end)
 {
-	char *endptr;
+	while (s < end && isspace(*s))
+		s++;
+	while (end > s && isspace(end[-1]))
+		end--;
+	*end = '\0';
 
-	long ret = strtol(s, &endptr, 10);
-	if (!endptr || *endptr != '\0') {
-		return -1;
-	}
-
-	return ret;
+	return s;
 }
 
-static int add_uevent_entry(struct sys_block_info *info, const char *filename)
+static int get_int(const char *s)
 {
-	FILE *fp;
-	char line[128];
+	char *endptr;
 
-	// open file
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
-		ERROR("Can't open file %s!\n", filename);
+	long ret = strtol(s, &endptr, 10);
+	if (endptr == s || *endptr != '\0') {
 		return -1;
 	}
-	// allocate memory
-	int index = info->num_entries++;
-	info->entries =
-	    realloc(info->entries,
-		    info->num_entries * sizeof(info->entries[0]));
-	memset(&info->entries[index], 0, sizeof(info->entries[0]));
 
-	// parse file
-	while (fgets(line, sizeof(line), fp) != NULL) {
-		char *name = copy_trim(strtok(line, "="));
-		char *value = copy_trim(strtok(NULL, "="));
+	return ret;
+}
 
-		if (!name || !value)
-			continue;
+#define KEY_IS(key, klen, name) \
+	((klen) == sizeof(name) - 1 && !memcmp(key, name, sizeof(name) - 1))
 
-		if (!strcmp(name, "MAJOR")) {
-			info->entries[index].linux_major = getInt(value);
-		} else if (!strcmp(name, "MINOR")) {
-			info->entries[index].linux_minor = getInt(value);
-		} else if (!strcmp(name, "PARTN")) {
-			info->entries[index].part_minor = getInt(value);
-		} else if (!strcmp(name, "DEVNAME")) {
-			info->entries[index].devname = strdup(value);
-		} else if (!strcmp(name, "PARTNAME")) {
-			info->entries[index].partname = strdup(value);
-		} else if (!strcmp(name, "DEVTYPE")) {
+/*
+ * parse the content of an uevent file in place
+ */
+static void parse_uevent(struct sys_block_uevent *event, char *buf,
+			 size_t len)
+{
+	char *line = buf, *end = buf + len;
+
+	while (line < end) {
+		char *eol = memchr(line, '\n', end - line);
+		char *eq, *key, *value;
+		size_t klen;
+
+		if (!eol)
+			eol = end;
+
+		eq = memchr(line, '=', eol - line);
+		if (!eq)
+			goto next;
+
+		value = trim(eq + 1, eol);
+		key = trim(line, eq);
+		klen = strlen(key);
+
+		if (KEY_IS(key, klen, "MAJOR")) {
+			event->linux_major = get_int(value);
+		} else if (KEY_IS(key, klen, "MINOR")) {
+			event->linux_minor = get_int(value);
+		} else if (KEY_IS(key, klen, "PARTN")) {
+			event->part_minor = get_int(value);
+		} else if (KEY_IS(key, klen, "DEVNAME")) {
+			event->devname = strdup(value);
+		} else if (KEY_IS(key, klen, "PARTNAME")) {
+			event->partname = strdup(value);
+		} else if (KEY_IS(key, klen, "DEVTYPE")) {
 			if (!strcmp(value, "disk"))
-				info->entries[index].type = UEVENT_TYPE_DISK;
+				event->type = UEVENT_TYPE_DISK;
 			else if (!strcmp(value, "partition"))
-				info->entries[index].type =
-				    UEVENT_TYPE_PARTITION;
+				event->type = UEVENT_TYPE_PARTITION;
 			else
-				info->entries[index].type = UEVENT_TYPE_UNKNOWN;
+				event->type = UEVENT_TYPE_UNKNOWN;
 		}
+
+next:
+		line = eol + 1;
 	}
 
 	unsigned part_major, part_minor;
 	// MMC
-	if (sscanf
-	    (info->entries[index].devname, "mmcblk%up%u", &part_major,
-	     &part_minor) == 2) {
-		info->entries[index].part_major = part_major;
-		info->entries[index].part_minor = part_minor;
+	if (event->devname
+	    && sscanf(event->devname, "mmcblk%up%u", &part_major,
+		      &part_minor) == 2) {
+		event->part_major = part_major;
+		event->part_minor = part_minor;
 	}
 	// TODO NAND
+}
+
+static int read_uevent_entry(int dirfd, const char *name,
+			     struct sys_block_uevent *event)
+{
+	char path[UEVENT_NAME_MAX + sizeof("/uevent")];
+	char buf[1024];
+	ssize_t len;
+	int fd;
+
+	memset(event, 0, sizeof(event[0]));
+
+	snprintf(path, sizeof(path), "%s/uevent", name);
+	fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		ERROR("Can't open file %s/%s!\n", UEVENT_PATH_BLOCK_DEVICES,
+		      path);
+		return -1;
+	}
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len < 0) {
+		ERROR("Can't read file %s/%s!\n", UEVENT_PATH_BLOCK_DEVICES,
+		      path);
+		return -1;
+	}
+
+	parse_uevent(event, buf, len);
+	return 0;
+}
+
+static void *uevent_scan_worker(void *arg)
+{
+	struct uevent_scan *scan = arg;
+	int i;
+
+	while ((i = __sync_fetch_and_add(&scan->next, 1)) < scan->count)
+		read_uevent_entry(scan->dirfd, scan->names[i],
+				  &scan->entries[i]);
+
+	return NULL;
+}
+
+static int uevent_num_threads(int count)
+{
+	long cpus;
+
+	if (count < UEVENT_THREAD_MIN_DEVICES)
+		return 1;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		return 1;
+
+	return cpus < UEVENT_MAX_THREADS ? cpus : UEVENT_MAX_THREADS;
+}
+
+static int uevent_list_devices(DIR * d, struct uevent_scan *scan)
+{
+	struct dirent *dt;
+	int num_alloc = 0;
+
+	while ((dt = readdir(d))) {
+		if (dt->d_type != DT_LNK)
+			continue;
 
-	// close file
-	fclose(fp);
+		if (strlen(dt->d_name) >= UEVENT_NAME_MAX) {
+			WARNING("%s: name too long: %s\n", __func__,
+				dt->d_name);
+			continue;
+		}
+
+		if (scan->count == num_alloc) {
+			void *names;
+
+			num_alloc = num_alloc ? num_alloc * 2 : 64;
+			names = realloc(scan->names,
+					num_alloc * sizeof(scan->names[0]));
+			if (!names)
+				return -1;
+			scan->names = names;
+		}
+
+		strcpy(scan->names[scan->count++], dt->d_name);
+	}
 
 	return 0;
 }
 
 struct sys_block_info *get_block_devices(void)
 {
-	const char *path = UEVENT_PATH_BLOCK_DEVICES;
-	char buf[PATH_MAX];
-	struct sys_block_info *info = malloc(sizeof(struct sys_block_info));
-	memset(info, 0, sizeof(info[0]));
+	struct uevent_scan scan;
+	struct sys_block_info *info;
+	struct timespec start;
+	pthread_t threads[UEVENT_MAX_THREADS];
+	int i, num_threads, num_started = 0;
+	DIR *d;
 
-	// find fstabs in root dir
-	DIR *d = opendir(path);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	memset(&scan, 0, sizeof(scan));
+
+	d = opendir(UEVENT_PATH_BLOCK_DEVICES);
 	if (!d) {
 		kperror("opendir");
 		return NULL;
 	}
+	scan.dirfd = dirfd(d);
 
-	struct dirent *dt;
-	while ((dt = readdir(d))) {
-		if (dt->d_type != DT_LNK)
-			continue;
+	if (uevent_list_devices(d, &scan)) {
+		kperror("uevent_list_devices");
+		goto err;
+	}
 
-		snprintf(buf, ARRAY_SIZE(buf), "%s/%s/uevent", path,
-			 dt->d_name);
-		add_uevent_entry(info, buf);
+	scan.entries = calloc(scan.count ? scan.count : 1,
+			      sizeof(scan.entries[0]));
+	if (!scan.entries) {
+		kperror("calloc");
+		goto err;
+	}
+	// parse uevent files, the main thread helps out
+	num_threads = uevent_num_threads(scan.count);
+	for (i = 1; i < num_threads; i++) {
+		if (pthread_create(&threads[num_started], NULL,
+				   uevent_scan_worker, &scan))
+			break;
+		num_started++;
 	}
+	uevent_scan_worker(&scan);
+	for (i = 0; i < num_started; i++)
+		pthread_join(threads[i], NULL);
 
 	if (closedir(d)) {
 		kperror("closedir");
+		d = NULL;
+		goto err;
+	}
+	free(scan.names);
+
+	info = calloc(1, sizeof(struct sys_block_info));
+	if (!info) {
+		free(scan.entries);
 		return NULL;
 	}
+	// drop the entries we couldn't read
+	for (i = 0; i < scan.count; i++) {
+		if (!scan.entries[i].devname) {
+			free(scan.entries[i].partname);
+			continue;
+		}
+		scan.entries[info->num_entries++] = scan.entries[i];
+	}
+	info->entries = scan.entries;
+
+	if (uevent_build_index(info)) {
+		free_block_devices(info);
+		return NULL;
+	}
+
+	INFO("%s: %d devices in %ldus using %d threads\n", __func__,
+	     info->num_entries, elapsed_us(&start), num_started + 1);
 
 	return info;
+
+err:
+	free(scan.names);
+	free(scan.entries);
+	if (d)
+		closedir(d);
+	return NULL;
 }
 
 void free_block_devices(struct sys_block_info *info)
@@ -134,95 +315,567 @@ void free_block_devices(struct sys_block_info *info)
 			free(event->devname);
 		if (event->partname)
 			free(event->partname);
-		free(event);
 	}
 
+	for (i = 0; i < UEVENT_INDEX_MAX; i++)
+		free(info->index[i]);
+
+	free(info->entries);
 	free(info);
 }
 
-struct sys_block_uevent *get_blockinfo_for_path(struct sys_block_info *info,
-						const char *path)
+struct uevent_key {
+	const char *name;
+	unsigned major;
+	unsigned minor;
+};
+
+static bool event_get_key(const struct sys_block_uevent *event, int type,
+			  struct uevent_key *key)
 {
-	char *name = NULL;
-	unsigned part_major, part_minor;
-	bool use_name = false;
-	int i;
-	struct sys_block_uevent *ret = NULL;
+	memset(key, 0, sizeof(key[0]));
+
+	switch (type) {
+	case UEVENT_INDEX_PARTNAME:
+		key->name = event->partname;
+		return key->name != NULL;
+	case UEVENT_INDEX_DEVNAME:
+		key->name = event->devname;
+		return key->name != NULL;
+	case UEVENT_INDEX_PART:
+		key->major = event->part_major;
+		key->minor = event->part_minor;
+		return true;
+	case UEVENT_INDEX_DEV:
+		key->major = event->linux_major;
+		key->minor = event->linux_minor;
+		return true;
+	}
 
-	if (strstr(path, "by-name") != NULL) {
-		char *tmp = strdup(path);
-		char *bname = basename(tmp);
-		name = strdup(bname);
-		free(tmp);
-		use_name = true;
-	} else
-	    if (sscanf(path, "/dev/block/mmcblk%up%u", &part_major, &part_minor)
-		!= 2) {
-		printf("ERROR\n");
+	return false;
+}
+
+static uint32_t key_hash(const struct uevent_key *key)
+{
+	if (key->name)
+		return hash_string(key->name);
+
+	return hash_u64(((uint64_t) key->major << 32) | key->minor);
+}
+
+static bool key_equal(const struct uevent_key *a, const struct uevent_key *b)
+{
+	if (a->name || b->name)
+		return a->name && b->name && !strcmp(a->name, b->name);
+
+	return a->major == b->major && a->minor == b->minor;
+}
+
+static struct sys_block_uevent *index_find(struct sys_block_info *info,
+					   int type,
+					   const struct uevent_key *key)
+{
+	unsigned mask = info->index_size - 1;
+	unsigned i;
+	int *slots = info->index[type];
+
+	if (!slots)
 		return NULL;
+
+	for (i = key_hash(key) & mask; slots[i]; i = (i + 1) & mask) {
+		struct sys_block_uevent *event = &info->entries[slots[i] - 1];
+		struct uevent_key event_key;
+
+		if (event_get_key(event, type, &event_key)
+		    && key_equal(&event_key, key))
+			return event;
+	}
+
+	return NULL;
+}
+
+/*
+ * (re)build all lookup indices. If two entries have the same key, the one
+ * which comes first wins, just like a linear scan would do.
+ */
+int uevent_build_index(struct sys_block_info *info)
+{
+	unsigned size = hash_table_size(info->num_entries);
+	int type, i;
+
+	for (type = 0; type < UEVENT_INDEX_MAX; type++) {
+		free(info->index[type]);
+		info->index[type] = calloc(size, sizeof(int));
+		if (!info->index[type]) {
+			kperror("calloc");
+			return -1;
+		}
 	}
+	info->index_size = size;
 
 	for (i = 0; i < info->num_entries; i++) {
-		struct sys_block_uevent *event = &info->entries[i];
+		for (type = 0; type < UEVENT_INDEX_MAX; type++) {
+			struct uevent_key key;
+			int *slots = info->index[type];
+			unsigned j;
 
-		if (use_name && event->partname
-		    && !strcmp(event->partname, name)) {
-			ret = event;
-			break;
-		} else if (event->part_major == part_major
-			   && event->part_minor == part_minor) {
-			ret = event;
-			break;
+			if (!event_get_key(&info->entries[i], type, &key))
+				continue;
+
+			if (index_find(info, type, &key))
+				continue;
+
+			for (j = key_hash(&key) & (size - 1); slots[j];
+			     j = (j + 1) & (size - 1)) ;
+			slots[j] = i + 1;
 		}
 	}
 
-	if (name)
-		free(name);
+	return 0;
+}
+
+static struct sys_block_uevent *lookup_path(struct sys_block_info *info,
+					   const char *path, bool *supported)
+{
+	struct uevent_key key;
+
+	memset(&key, 0, sizeof(key));
+	*supported = true;
 
-	return ret;
+	if (strstr(path, "by-name") != NULL) {
+		key.name = strrchr(path, '/') + 1;
+		return index_find(info, UEVENT_INDEX_PARTNAME, &key);
+	}
+
+	if (sscanf(path, "/dev/block/mmcblk%up%u", &key.major, &key.minor)
+	    == 2)
+		return index_find(info, UEVENT_INDEX_PART, &key);
+
+	// other devices directly in /dev/block
+	if (!strncmp(path, "/dev/block/", sizeof("/dev/block/") - 1)
+	    && !strchr(path + sizeof("/dev/block/") - 1, '/')) {
+		key.name = path + sizeof("/dev/block/") - 1;
+		return index_find(info, UEVENT_INDEX_DEVNAME, &key);
+	}
+
+	*supported = false;
+	return NULL;
+}
+
+struct sys_block_uevent *get_blockinfo_for_path(struct sys_block_info *info,
+						const char *path)
+{
+	struct sys_block_uevent *event;
+	bool supported;
+
+	event = lookup_path(info, path, &supported);
+	if (!supported)
+		ERROR("%s: unsupported path %s\n", __func__, path);
+
+	return event;
+}
+
+/*
+ * whether get_blockinfo_for_path() knows how to resolve 'path' at all
+ */
+int uevent_path_supported(struct sys_block_info *info, const char *path)
+{
+	bool supported;
+
+	pthread_mutex_lock(&uevent_lock);
+	lookup_path(info, path, &supported);
+	pthread_mutex_unlock(&uevent_lock);
+
+	return supported;
+}
+
+struct sys_block_uevent *get_blockinfo_for_dev(struct sys_block_info *info,
+					       dev_t dev)
+{
+	struct uevent_key key;
+
+	memset(&key, 0, sizeof(key));
+	key.major = major(dev);
+	key.minor = minor(dev);
+
+	return index_find(info, UEVENT_INDEX_DEV, &key);
 }
 
 char *uevent_realpath(struct sys_block_info *info,
 		      const char *path, char *resolved_path)
 {
-	struct sys_block_uevent *bi = get_blockinfo_for_path(info, path);
-	if (!bi)
-		return NULL;
+	struct sys_block_uevent *bi;
+	char *ret = NULL;
+
+	pthread_mutex_lock(&uevent_lock);
+	bi = get_blockinfo_for_path(info, path);
+	if (bi) {
+		sprintf(resolved_path, "/dev/block/%s", bi->devname);
+		ret = resolved_path;
+	}
+	pthread_mutex_unlock(&uevent_lock);
 
-	sprintf(resolved_path, "/dev/block/mmcblk%up%u", bi->part_major,
-		bi->part_minor);
-	return resolved_path;
+	return ret;
 }
 
 int uevent_stat(struct sys_block_info *info, const char *path, struct stat *buf)
 {
-	struct sys_block_uevent *bi = get_blockinfo_for_path(info, path);
-	if (!bi)
-		return -1;
-
-	buf->st_dev = makedev(0, 5);
-	buf->st_rdev = makedev(bi->linux_major, bi->linux_minor);
+	struct sys_block_uevent *bi;
+	int ret = -1;
+
+	pthread_mutex_lock(&uevent_lock);
+	bi = get_blockinfo_for_path(info, path);
+	if (bi) {
+		buf->st_dev = makedev(0, 5);
+		buf->st_rdev = makedev(bi->linux_major, bi->linux_minor);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&uevent_lock);
 
-	return 0;
+	return ret;
 }
 
 int uevent_create_nodes(struct sys_block_info *info, const char *path)
 {
-	int i;
+	int i, dirfd;
 	char buf[PATH_MAX];
+	struct timespec start;
 
-	mkdir(PATH_MOUNTPOINT_DEV "/block", 0755);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	snprintf(buf, sizeof(buf), "%s/block", path);
+	mkdir(buf, 0755);
+
+	dirfd = open(buf, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0) {
+		kperror("open");
+		return -1;
+	}
 
 	for (i = 0; i < info->num_entries; i++) {
 		struct sys_block_uevent *event = &info->entries[i];
 
-		snprintf(buf, sizeof(buf), "%s/block/%s", path, event->devname);
-
-		if (mknod
-		    (buf, S_IFBLK | 0600,
+		if (mknodat
+		    (dirfd, event->devname, S_IFBLK | 0600,
 		     makedev(event->linux_major, event->linux_minor)))
 			kperror("mknod");
 	}
 
+	close(dirfd);
+
+	INFO("%s: %d nodes in %ldus\n", __func__, info->num_entries,
+	     elapsed_us(&start));
+
+	return 0;
+}
+
+/*
+ * open the uevent socket. the kernel queues events from now on, so
+ * devices showing up during the sysfs scan don't get lost
+ */
+int uevent_listener_init(void)
+{
+	struct sockaddr_nl addr;
+	int size = UEVENT_RCVBUF;
+	int sock;
+
+	if (listener.sock >= 0)
+		return 0;
+
+	sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+		      NETLINK_KOBJECT_UEVENT);
+	if (sock < 0)
+		return -1;
+
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(sock);
+		return -1;
+	}
+
+	listener.sock = sock;
+	return 0;
+}
+
+static struct sys_block_uevent *find_devname(struct sys_block_info *info,
+					     const char *devname)
+{
+	struct uevent_key key;
+
+	memset(&key, 0, sizeof(key));
+	key.name = devname;
+
+	return index_find(info, UEVENT_INDEX_DEVNAME, &key);
+}
+
+static void free_event(struct sys_block_uevent *event)
+{
+	free(event->devname);
+	free(event->partname);
+}
+
+/*
+ * add or replace an entry, takes ownership of the event's strings
+ */
+static int blockinfo_update(struct sys_block_info *info,
+			    struct sys_block_uevent *event)
+{
+	struct sys_block_uevent *old, *entries;
+
+	old = find_devname(info, event->devname);
+	if (old) {
+		free_event(old);
+		*old = *event;
+		return uevent_build_index(info);
+	}
+
+	entries = realloc(info->entries,
+			  (info->num_entries + 1) * sizeof(entries[0]));
+	if (!entries) {
+		free_event(event);
+		return -1;
+	}
+	info->entries = entries;
+	info->entries[info->num_entries++] = *event;
+
+	return uevent_build_index(info);
+}
+
+static int blockinfo_remove(struct sys_block_info *info, const char *devname)
+{
+	struct sys_block_uevent *old = find_devname(info, devname);
+	int i;
+
+	if (!old)
+		return 0;
+
+	// keep the order, the first entry wins for duplicate keys
+	i = old - info->entries;
+	free_event(old);
+	memmove(old, old + 1, (info->num_entries - i - 1) * sizeof(old[0]));
+	info->num_entries--;
+
+	return uevent_build_index(info);
+}
+
+static void update_node(const struct sys_block_uevent *event, bool add)
+{
+	char path[PATH_MAX];
+
+	if (strchr(event->devname, '/'))
+		return;
+
+	snprintf(path, sizeof(path), "%s/block/%s", listener.dev_path,
+		 event->devname);
+
+	// the numbers can change if a device is replaced
+	unlink(path);
+	if (add && mknod(path, S_IFBLK | 0600,
+			 makedev(event->linux_major, event->linux_minor)))
+		kperror("mknod");
+}
+
+/*
+ * a message is an "action@devpath" header followed by
+ * nul-separated KEY=value pairs
+ */
+static void uevent_handle(char *msg, size_t len)
+{
+	struct sys_block_uevent event;
+	char *body, *p, *end = msg + len;
+	bool block = false, add = false, remove = false;
+
+	body = msg + strlen(msg) + 1;
+	for (p = body; p < end; p += strlen(p) + 1) {
+		if (!strcmp(p, "SUBSYSTEM=block"))
+			block = true;
+		else if (!strcmp(p, "ACTION=add") || !strcmp(p, "ACTION=change"))
+			add = true;
+		else if (!strcmp(p, "ACTION=remove"))
+			remove = true;
+	}
+	if (!block || (!add && !remove))
+		return;
+
+	// parse_uevent wants the format of the sysfs files
+	for (p = body; p < end; p++) {
+		if (!*p)
+			*p = '\n';
+	}
+
+	memset(&event, 0, sizeof(event));
+	parse_uevent(&event, body, end - body);
+	if (!event.devname) {
+		free_event(&event);
+		return;
+	}
+
+	INFO("%s: %s %s (%u:%u)\n", __func__, add ? "add" : "remove",
+	     event.devname, event.linux_major, event.linux_minor);
+	update_node(&event, add);
+
+	pthread_mutex_lock(&uevent_lock);
+	if (add) {
+		if (blockinfo_update(listener.info, &event))
+			ERROR("%s: can't add %s\n", __func__, msg);
+	} else {
+		if (blockinfo_remove(listener.info, event.devname))
+			ERROR("%s: can't remove %s\n", __func__, msg);
+		free_event(&event);
+	}
+	listener.seq++;
+	pthread_cond_broadcast(&uevent_cond);
+	pthread_mutex_unlock(&uevent_lock);
+}
+
+static void *uevent_listener_thread(void *arg)
+{
+	char buf[UEVENT_MSG_LEN + 1];
+
+	(void)arg;
+
+	for (;;) {
+		struct sockaddr_nl addr;
+		socklen_t addrlen = sizeof(addr);
+		ssize_t n;
+
+		n = recvfrom(listener.sock, buf, UEVENT_MSG_LEN, 0,
+			     (struct sockaddr *)&addr, &addrlen);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				WARNING("%s: lost uevents\n", __func__);
+				continue;
+			}
+			kperror("recvfrom");
+			break;
+		}
+
+		// only trust the kernel
+		if (!n || addr.nl_pid != 0)
+			continue;
+
+		buf[n] = '\0';
+		uevent_handle(buf, n);
+	}
+
+	pthread_mutex_lock(&uevent_lock);
+	listener.running = false;
+	pthread_cond_broadcast(&uevent_cond);
+	pthread_mutex_unlock(&uevent_lock);
+
+	return NULL;
+}
+
+/*
+ * waits are timed against the monotonic clock,
+ * the wall clock usually gets set during boot
+ */
+static void uevent_cond_init(void)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&uevent_cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/*
+ * keep 'info' and the nodes in 'dev_path'/block up to date.
+ * get_blockinfo_for_* results are only stable until the next uevent
+ */
+int uevent_listener_start(struct sys_block_info *info, const char *dev_path)
+{
+	sigset_t all, old;
+	pthread_t thread;
+	int rc;
+
+	if (uevent_listener_init())
+		return -1;
+
+	pthread_once(&uevent_cond_once, uevent_cond_init);
+	listener.info = info;
+	listener.dev_path = dev_path;
+	listener.running = true;
+
+	// signals are meant for the tracer
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	rc = pthread_create(&thread, NULL, uevent_listener_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (rc) {
+		listener.running = false;
+		errno = rc;
+		return -1;
+	}
+	pthread_detach(thread);
+
 	return 0;
 }
+
+unsigned uevent_listener_seq(void)
+{
+	unsigned seq;
+
+	pthread_mutex_lock(&uevent_lock);
+	seq = listener.seq;
+	pthread_mutex_unlock(&uevent_lock);
+
+	return seq;
+}
+
+/*
+ * wait until the kernel announced the device behind 'path'.
+ * returns -1 with errno set to ETIMEDOUT on timeout, or to ENODEV right
+ * away if there's no listener running or 'path' can't be matched to a uevent
+ */
+int uevent_wait_for_device(const char *path, int timeout_ms)
+{
+	struct timespec deadline;
+	bool supported;
+	int rc = 0, err = 0;
+
+	pthread_once(&uevent_cond_once, uevent_cond_init);
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&uevent_lock);
+	for (;;) {
+		if (!listener.running) {
+			err = ENODEV;
+			break;
+		}
+		if (lookup_path(listener.info, path, &supported))
+			break;
+		if (!supported) {
+			err = ENODEV;
+			break;
+		}
+		if (pthread_cond_timedwait(&uevent_cond, &uevent_lock,
+					   &deadline) == ETIMEDOUT) {
+			err = ETIMEDOUT;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&uevent_lock);
+
+	if (err) {
+		errno = err;
+		rc = -1;
+	}
+
+	return rc;
+}
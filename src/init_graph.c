@@ -0,0 +1,230 @@
+#include <common.h>
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * dependency-graph scheduler for the early init stages
+ *
+ * Every stage runs in its own thread once the resources it needs are
+ * available, so independent work (e.g. parsing fstabs while e2fsck checks
+ * the source partition) overlaps. When a stage fails no further stages
+ * are started.
+ *
+ * For every stage we remember which dependency finished last. Following
+ * these links back from the stage that finished last gives the critical
+ * path, which is what bounds the boot time.
+ */
+
+#define MAX_INIT_STAGES 32
+
+enum stage_state {
+	STAGE_WAITING,
+	STAGE_RUNNING,
+	STAGE_FINISHED,
+	STAGE_DONE,
+};
+
+struct stage_run {
+	const struct init_stage *stage;
+	struct module_data *data;
+	pthread_t thread;
+	enum stage_state state;
+	int rc;
+	// relative to the start of init_graph_run
+	long start_us;
+	long end_us;
+	// dependency that finished last, -1 if there's none
+	int blocker;
+};
+
+static struct stage_run stages[MAX_INIT_STAGES];
+static unsigned stages_count = 0;
+
+static pthread_mutex_t graph_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t graph_cond = PTHREAD_COND_INITIALIZER;
+static struct timespec graph_start;
+
+static long elapsed_us(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000L +
+	    (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+int init_graph_add(const struct init_stage *stage)
+{
+	if (stages_count >= ARRAY_SIZE(stages)) {
+		ERROR("%s: too many stages!\n", __func__);
+		return -1;
+	}
+
+	memset(&stages[stages_count], 0, sizeof(stages[0]));
+	stages[stages_count].stage = stage;
+	stages[stages_count].blocker = -1;
+	stages_count++;
+
+	return 0;
+}
+
+int init_graph_add_stages(const struct init_stage *list)
+{
+	for (; list->name; list++) {
+		if (init_graph_add(list))
+			return -1;
+	}
+
+	return 0;
+}
+
+static void *stage_thread(void *arg)
+{
+	struct stage_run *s = arg;
+	int rc;
+
+	DEBUG("%s: %s\n", __func__, s->stage->name);
+	rc = s->stage->run(s->data);
+
+	pthread_mutex_lock(&graph_lock);
+	s->rc = rc;
+	s->end_us = elapsed_us(&graph_start);
+	s->state = STAGE_FINISHED;
+	pthread_cond_signal(&graph_cond);
+	pthread_mutex_unlock(&graph_lock);
+
+	return NULL;
+}
+
+/*
+ * the stage providing one of our needs that finished last
+ */
+static int find_blocker(const struct stage_run *s)
+{
+	int i, blocker = -1;
+
+	for (i = 0; i < (int)stages_count; i++) {
+		const struct stage_run *dep = &stages[i];
+
+		if (dep->state != STAGE_DONE || dep->rc ||
+		    !(dep->stage->provides & s->stage->needs))
+			continue;
+		if (blocker < 0 || dep->end_us > stages[blocker].end_us)
+			blocker = i;
+	}
+
+	return blocker;
+}
+
+static void init_graph_report(void)
+{
+	int path[MAX_INIT_STAGES];
+	int i, n = 0, last = -1;
+	long busy = 0;
+
+	for (i = 0; i < (int)stages_count; i++) {
+		struct stage_run *s = &stages[i];
+
+		if (s->state != STAGE_DONE)
+			continue;
+
+		INFO("%s: %s: %ldms-%ldms\n", __func__, s->stage->name,
+		     s->start_us / 1000, s->end_us / 1000);
+		busy += s->end_us - s->start_us;
+		if (last < 0 || s->end_us > stages[last].end_us)
+			last = i;
+	}
+
+	if (last < 0)
+		return;
+
+	for (i = last; i >= 0; i = stages[i].blocker)
+		path[n++] = i;
+
+	INFO("%s: %ldms total, %ldms of work\n", __func__,
+	     stages[last].end_us / 1000, busy / 1000);
+	INFO("%s: critical path:\n", __func__);
+	while (n--) {
+		struct stage_run *s = &stages[path[n]];
+
+		INFO("%s:   %s: %ldms\n", __func__, s->stage->name,
+		     (s->end_us - s->start_us) / 1000);
+	}
+}
+
+/*
+ * run all registered stages, returns -1 if any of them failed or
+ * couldn't be started because of unsatisfiable needs
+ */
+int init_graph_run(struct module_data *data)
+{
+	unsigned available = 0;
+	int running = 0;
+	bool failed = false;
+	unsigned i;
+
+	clock_gettime(CLOCK_MONOTONIC, &graph_start);
+
+	pthread_mutex_lock(&graph_lock);
+	for (;;) {
+		// start everything that is ready now
+		for (i = 0; i < stages_count && !failed; i++) {
+			struct stage_run *s = &stages[i];
+
+			if (s->state != STAGE_WAITING ||
+			    (s->stage->needs & ~available))
+				continue;
+
+			s->data = data;
+			s->blocker = find_blocker(s);
+			s->start_us = elapsed_us(&graph_start);
+			s->state = STAGE_RUNNING;
+			if (pthread_create(&s->thread, NULL, stage_thread, s)) {
+				ERROR("%s: can't start %s\n", __func__,
+				      s->stage->name);
+				s->state = STAGE_WAITING;
+				failed = true;
+				break;
+			}
+			running++;
+		}
+
+		if (!running)
+			break;
+
+		pthread_cond_wait(&graph_cond, &graph_lock);
+
+		for (i = 0; i < stages_count; i++) {
+			struct stage_run *s = &stages[i];
+
+			if (s->state != STAGE_FINISHED)
+				continue;
+
+			pthread_join(s->thread, NULL);
+			s->state = STAGE_DONE;
+			running--;
+
+			if (s->rc) {
+				ERROR("%s: %s failed\n", __func__,
+				      s->stage->name);
+				failed = true;
+			} else {
+				available |= s->stage->provides;
+			}
+		}
+	}
+	pthread_mutex_unlock(&graph_lock);
+
+	for (i = 0; i < stages_count && !failed; i++) {
+		if (stages[i].state == STAGE_WAITING) {
+			ERROR("%s: %s needs 0x%x, only 0x%x is available\n",
+			      __func__, stages[i].stage->name,
+			      stages[i].stage->needs, available);
+			failed = true;
+		}
+	}
+
+	init_graph_report();
+
+	return failed ? -1 : 0;
+}
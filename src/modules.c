@@ -10,6 +10,19 @@ void module_register(struct module *module)
 	modules[modules_count++] = module;
 }
 
+int modules_add_stages(void)
+{
+	int i;
+
+	for (i = 0; i < modules_count; i++) {
+		if (modules[i] && modules[i]->stages
+		    && init_graph_add_stages(modules[i]->stages))
+			return -1;
+	}
+
+	return 0;
+}
+
 const char *strbootmode(bootmode_t bm)
 {
 	switch (bm) {
@@ -1,91 +1,133 @@
 #include <common.h>
 
+static const struct copy_tree_mode multiboot_modes[] = {
+	{"etc", 0600},
+	{"sbin", 0700},
+	{NULL, 0},
+};
+
 /*
- * 1) mount grub root (if we don't use a ramdisk)
- * 2) setup /multiboot
- * 3) mount source partition
+ * mount grub root (if we don't use a ramdisk)
  */
-static int ep_early_init(struct module_data *data)
+static int ep_mount_grub(struct module_data *data)
 {
-	int rc = 0;
 	char part_grub[PATH_MAX];
-	char part_source[PATH_MAX];
-	char buf[PATH_MAX];
-	char buf2[PATH_MAX];
-
-	// mount grub device
-	if (data->grub_device.blk_device != NULL && data->grub_path != NULL) {
-		// mount grub partition
-		snprintf(part_grub, sizeof(part_grub), "/multiboot%s",
-			 data->grub_device.blk_device);
-		if (util_mount(part_grub, PATH_MOUNTPOINT_GRUB, NULL, 0, NULL)) {
-			kperror("mount(grub_device)");
-			rc = -1;
-			goto finish;
-		}
-		// bind mount subfolder
-		snprintf(part_grub, sizeof(part_grub),
-			 PATH_MOUNTPOINT_GRUB "/%s/..", data->grub_path);
-		if (util_mount
-		    (part_grub, PATH_MOUNTPOINT_BOOTLOADER, NULL, MS_BIND,
-		     NULL)) {
-			kperror("mount(grub_device|bind)");
-			rc = -1;
-			goto finish;
-		}
+
+	if (data->grub_device.blk_device == NULL || data->grub_path == NULL)
+		return 0;
+
+	// mount grub partition
+	snprintf(part_grub, sizeof(part_grub), "/multiboot%s",
+		 data->grub_device.blk_device);
+	if (util_mount(part_grub, PATH_MOUNTPOINT_GRUB, NULL, 0, NULL)) {
+		kperror("mount(grub_device)");
+		return -1;
+	}
+	// bind mount subfolder
+	snprintf(part_grub, sizeof(part_grub),
+		 PATH_MOUNTPOINT_GRUB "/%s/..", data->grub_path);
+	if (util_mount
+	    (part_grub, PATH_MOUNTPOINT_BOOTLOADER, NULL, MS_BIND, NULL)) {
+		kperror("mount(grub_device|bind)");
+		return -1;
 	}
+
+	return 0;
+}
+
+/*
+ * setup /multiboot
+ */
+static int ep_copy_multiboot(struct module_data *data)
+{
 	// create local copy of multiboot files
 	// the original filesystem could be mounted with noexec
-	util_copy(PATH_MOUNTPOINT_BOOTLOADER "/multiboot", "/", true, true);
-	chmod(PATH_MULTIBOOT_BUSYBOX, 0700);	// in case we lost permission
+	// with more secure permissions for etc and sbin
+	if (copy_tree(PATH_MOUNTPOINT_BOOTLOADER "/multiboot", "/multiboot",
+		      multiboot_modes, true))
+		kperror("copy_tree(multiboot)");
+
+	// visual recovery patches
+	if (data->bootmode == BOOTMODE_RECOVERY && data->multiboot_enabled) {
+		util_copy("/multiboot/res/twrp_curtain.jpg",
+			  "/res/images/curtain.jpg", false, false);
+	}
 
-	// update to more secure permissions
-	util_chmod("/multiboot/etc", "0600", true);
-	util_chmod("/multiboot/sbin", "0700", true);
+	return 0;
+}
+
+/*
+ * mount source partition
+ */
+static int ep_mount_source(struct module_data *data)
+{
+	char part_source[PATH_MAX];
 
 	// convert source part
 	snprintf(part_source, sizeof(part_source), "/multiboot%s",
 		 data->multiboot_device.blk_device);
 
-	// mount source partition
 	if (util_mount(part_source, PATH_MOUNTPOINT_SOURCE, NULL, 0, NULL)) {
 		kperror("mount(multiboot_device)");
-		rc = -1;
-		goto finish;
+		return -1;
 	}
+
+	return 0;
+}
+
+/*
+ * register rc patches, they're applied once early init is done
+ */
+static int ep_rc_patches(struct module_data *data)
+{
+	char init_rc[PATH_MAX];
+	char recovery_rc[PATH_MAX];
+	char dualboot_init[PATH_MAX];
+	char fstab_patched[PATH_MAX];
+	char fstab[PATH_MAX];
+	struct rc_patch_rule rules[] = {
+		// dualboot_init
+		{init_rc, dualboot_init, "", RC_PATCH_REGEX},
+		// fstab loader
+		{init_rc, fstab_patched, fstab, 0},
+		// syspart_select
+		{recovery_rc, "exec /sbin/syspart_select auto", "", 0},
+		{NULL, NULL, NULL, 0},
+	};
+
 	// setup voldwrapper
 	if (data->bootmode != BOOTMODE_RECOVERY)
 		patch_vold();
 
-	// visual recovery patches
-	else if (data->multiboot_enabled) {
-		util_copy("/multiboot/res/twrp_curtain.jpg",
-			  "/res/images/curtain.jpg", false, false);
-	}
 	// ==== disable dualboot tools ====
-	// dualboot_init
-	snprintf(buf, ARRAY_SIZE(buf), "/init.%s.rc", data->hw_name);
-	snprintf(buf2, ARRAY_SIZE(buf2),
-		 "s/exec \\/sbin\\/dualboot_init .\\/fstab.%s//g",
+	snprintf(init_rc, sizeof(init_rc), "/init.%s.rc", data->hw_name);
+	snprintf(recovery_rc, sizeof(recovery_rc), "/init.recovery.%s.rc",
 		 data->hw_name);
-	sed_replace(buf, buf2);
-	unlink("/sbin/dualboot_init");
-
-	// fstab loader
-	snprintf(buf2, ARRAY_SIZE(buf2), "s/fstab.%s.patched/fstab.%s/g",
-		 data->hw_name, data->hw_name);
-	sed_replace(buf, buf2);
+	snprintf(dualboot_init, sizeof(dualboot_init),
+		 "exec /sbin/dualboot_init ./fstab.%s", data->hw_name);
+	snprintf(fstab_patched, sizeof(fstab_patched), "fstab.%s.patched",
+		 data->hw_name);
+	snprintf(fstab, sizeof(fstab), "fstab.%s", data->hw_name);
 
-	// syspart_select
-	snprintf(buf, ARRAY_SIZE(buf), "/init.recovery.%s.rc", data->hw_name);
-	sed_replace(buf, "s/exec \\/sbin\\/syspart_select auto//g");
+	if (rc_patch_add_rules(rules))
+		ERROR("can't add rc patches!\n");
+	unlink("/sbin/dualboot_init");
 	unlink("/sbin/syspart_select");
 	// ========
 
-finish:
-	return rc;
+	return 0;
 }
 
+static const struct init_stage ep_stages[] = {
+	{"grub_mount", ep_mount_grub, INIT_RES_DEV_NODES, INIT_RES_BOOTLOADER},
+	{"multiboot_copy", ep_copy_multiboot, INIT_RES_BOOTLOADER,
+	 INIT_RES_MULTIBOOT_FILES},
+	{"source_mount", ep_mount_source,
+	 INIT_RES_DEV_NODES | INIT_RES_MULTIBOOT_FILES, INIT_RES_SOURCE},
+	{"rc_patches", ep_rc_patches, 0, 0},
+	{NULL, NULL, 0, 0},
+};
+
 /*
  * setup multiboot diretories and images in case they don't exist
  */
@@ -170,7 +212,7 @@ finish:
 }
 
 static struct module module_env_prepare = {
-	.early_init = ep_early_init,
+	.stages = ep_stages,
 	.fstab_init = ep_fstab_init,
 };
 
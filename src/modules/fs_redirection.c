@@ -1,4 +1,5 @@
 #include <common.h>
+#include <sched.h>
 
 #define do_hook(syscall, hook) \
 if (tracy_set_hook(data->tracy, #syscall, TRACY_ABI_NATIVE, hook)) { \
@@ -75,50 +76,147 @@ static int hook_fileaccess(struct tracy_event *e)
 	return TRACY_HOOK_ABORT;
 }
 
-static bool fstab_rec_matches(const char *devname, struct fstab_rec *rec,
-			      struct stat *sb, bool use_stat)
+/*
+ * all redirectable fstab records, added in the order the old linear scan
+ * checked them (multiboot source, grub device, multiboot fstab)
+ */
+static struct fstab_index rec_index;
+
+// record whose device didn't exist when the index was built
+struct rec_pending {
+	struct fstab_rec *rec;
+	unsigned prio;
+};
+
+static struct rec_pending *pending_recs;
+static unsigned num_pending_recs;
+// uevent_listener_seq() of the last retry
+static unsigned pending_seq;
+
+// prefixes of all paths which can point to a redirected device
+static struct path_trie *devpath_filter;
+
+static void rec_index_insert(struct module_data *data, struct fstab_rec *rec)
 {
-	if (use_stat && sb->st_rdev == rec->statbuf.st_rdev) {
-		return true;
+	unsigned prio = fstab_index_add(&rec_index, rec);
+
+	// uevent_stat failed for this record, the device may show up later
+	// unless it's a path we can't resolve anyway
+	if (!rec->statbuf.st_rdev && rec->blk_device &&
+	    uevent_path_supported(data->block_info, rec->blk_device)) {
+		pending_recs[num_pending_recs].rec = rec;
+		pending_recs[num_pending_recs].prio = prio;
+		num_pending_recs++;
 	}
-	if (!strcmp(devname, rec->blk_device)) {
-		return true;
+}
+
+/*
+ * devices like sd cards can be plugged in after boot. retry the pending
+ * records whenever the uevent listener saw a change
+ */
+static bool rec_index_update(void)
+{
+	unsigned seq = uevent_listener_seq();
+	bool found = false;
+	unsigned i = 0;
+
+	if (seq == pending_seq)
+		return false;
+	pending_seq = seq;
+
+	while (i < num_pending_recs) {
+		struct rec_pending *p = &pending_recs[i];
+
+		if (uevent_stat(module_data->block_info, p->rec->blk_device,
+				&p->rec->statbuf) || !p->rec->statbuf.st_rdev) {
+			i++;
+			continue;
+		}
+
+		INFO("%s: %s showed up\n", __func__, p->rec->blk_device);
+		fstab_index_add_dev(&rec_index, p->rec, p->prio);
+		*p = pending_recs[--num_pending_recs];
+		found = true;
 	}
 
-	return false;
+	return found;
 }
 
-static struct fstab_rec *get_fstab_rec(const char *devname)
+static int devpath_filter_add_dir(const char *path)
 {
-	int i;
-	struct stat sb;
+	char buf[PATH_MAX];
+	char *slash;
 
-	bool use_stat = !stat(devname, &sb);
-	struct fstab *mbfstab = module_data->multiboot_fstab;
+	// relative paths never got resolved correctly anyway
+	if (!path || path[0] != '/')
+		return 0;
 
-	// multiboot source
-	if (module_data->multiboot_path && fstab_rec_matches
-	    (devname, &module_data->multiboot_device, &sb, use_stat)) {
-		return &module_data->multiboot_device;
+	strlcpy(buf, path, sizeof(buf));
+	slash = strrchr(buf, '/');
+	slash[1] = '\0';
+
+	return path_trie_add(devpath_filter, buf);
+}
+
+static int devpath_filter_build(void)
+{
+	unsigned i;
+	int rc = 0;
+
+	devpath_filter = path_trie_create();
+	if (!devpath_filter) {
+		ERROR("%s: couldn't allocate filter!\n", __func__);
+		return -1;
 	}
-	// grub device
-	if (module_data->grub_path && fstab_rec_matches
-	    (devname, &module_data->grub_device, &sb, use_stat)) {
-		return &module_data->grub_device;
+	// symlinks like by-name usually live here
+	rc |= path_trie_add(devpath_filter, "/dev/block/");
+	rc |= path_trie_add(devpath_filter, PATH_MOUNTPOINT_DEV "/block/");
+
+	for (i = 0; i < rec_index.size; i++) {
+		if (rec_index.by_path[i].rec)
+			rc |= devpath_filter_add_dir(rec_index.by_path[i].
+						     key.path);
 	}
 
-	for (i = 0; i < mbfstab->num_entries; i++) {
-		if (!fs_mgr_is_multiboot(&mbfstab->recs[i]))
-			continue;
+	return rc;
+}
 
-		if (fstab_rec_matches
-		    (devname, &mbfstab->recs[i], &sb, use_stat)) {
-			return &mbfstab->recs[i];
-		}
+static int rec_index_build(struct module_data *data)
+{
+	struct fstab *mbfstab = data->multiboot_fstab;
+	int i;
+
+	pending_recs = calloc(mbfstab->num_entries + 2,
+			      sizeof(pending_recs[0]));
+	if (!pending_recs
+	    || fstab_index_init(&rec_index, mbfstab->num_entries + 2)) {
+		ERROR("%s: couldn't allocate index!\n", __func__);
+		return -1;
+	}
+	// multiboot source
+	if (data->multiboot_path)
+		rec_index_insert(data, &data->multiboot_device);
+	// grub device
+	if (data->grub_path)
+		rec_index_insert(data, &data->grub_device);
+
+	for (i = 0; i < mbfstab->num_entries; i++) {
+		if (fs_mgr_is_multiboot(&mbfstab->recs[i]))
+			rec_index_insert(data, &mbfstab->recs[i]);
 	}
 
-	DEBUG("%s: no match for %s\n", __func__, devname);
-	return NULL;
+	return 0;
+}
+
+static struct fstab_rec *get_fstab_rec(const char *devname)
+{
+	struct fstab_rec *rec;
+
+	rec = fstab_index_lookup(&rec_index, devname, rec_index_update);
+	if (!rec)
+		DEBUG("%s: no match for %s\n", __func__, devname);
+
+	return rec;
 }
 
 static struct fd_info *make_fdinfo(struct tracy_child *child, unsigned int fd,
@@ -169,29 +267,77 @@ static void free_fdinfo(struct fd_info *fdi)
 	}
 }
 
-static void free_fdinfo_list(struct tracy_ll *ll)
+static void drop_fdinfo(int fd, void *data, void *arg)
 {
-	struct tracy_ll_item *t;
-
-	t = ll->head;
-
-	// free custom fields
-	while (t) {
-		if (t->data) {
-			struct fd_info *fdi = t->data;
-			if (fdi) {
-				WARNING("unclosed file: %d(%s)\n", t->id,
-					fdi->filename);
-				free_fdinfo(fdi);
-				t->data = NULL;
-			}
-		}
+	struct fd_info *fdi = data;
+	const char *reason = arg;
+
+	if (reason)
+		WARNING("%s file: %d(%s)\n", reason, fd, fdi->filename);
+
+	free_fdinfo(fdi);
+	free(fdi);
+}
+
+/*
+ * whether the fd is still open in the child, if we can tell
+ */
+static bool child_has_fd(struct tracy_child *child, int fd)
+{
+	char path[64];
+	struct stat sb;
+
+	snprintf(path, sizeof(path), "/multiboot/proc/%d/fd", child->pid);
+	if (lstat(path, &sb))
+		return true;
+
+	snprintf(path, sizeof(path), "/multiboot/proc/%d/fd/%d", child->pid,
+		 fd);
+	return !lstat(path, &sb);
+}
+
+/*
+ * duplicate an entry of the parent. a child which is running already
+ * could have closed the fd since the fork
+ */
+static void *copy_fdinfo(int fd, void *data, void *arg)
+{
+	struct tracy_child *child = arg;
+	struct fd_info *src = data;
+	struct fd_info *fdi;
 
-		t = t->next;
+	if (child && !child_has_fd(child, fd))
+		return NULL;
+
+	fdi = calloc(1, sizeof(struct fd_info));
+	if (!fdi) {
+		ERROR("Couldn't copy fdinfo for %s!\n", src->filename);
+		return NULL;
 	}
 
-	// free the list itself
-	ll_free(ll);
+	fdi->child = child;
+	fdi->fd = fd;
+	fdi->filename = strdup(src->filename);
+	if (src->fs_type)
+		fdi->fs_type = strdup(src->fs_type);
+	if (src->device)
+		fdi->device = strdup(src->device);
+	fs_clone(fdi, src);
+
+	return fdi;
+}
+
+static void drop_fdinfo_copy(int fd, void *data,
+			     void __attribute__ ((__unused__)) * arg)
+{
+	drop_fdinfo(fd, data, NULL);
+}
+
+static void set_fdinfo_child(int __attribute__ ((__unused__)) fd,
+			     void *data, void *arg)
+{
+	struct fd_info *fdi = data;
+	fdi->child = arg;
 }
 
 /*
@@ -214,11 +360,14 @@ static int hook_open(struct tracy_event *e, int argpos, bool resolve_symlinks)
 			goto out;
 
 		// get path
-		path = get_patharg(e->child, argptr[argpos], resolve_symlinks);
-		if (!path) {
+		if (get_patharg_filtered(e->child, argptr[argpos],
+					 resolve_symlinks, devpath_filter,
+					 &path)) {
 			rc = TRACY_HOOK_ABORT;
 			goto out;
 		}
+		if (!path)
+			goto out;
 		// check if we need to redirect this partition
 		fstabrec = get_fstab_rec(path);
 		if (!fstabrec) {
@@ -229,14 +378,17 @@ static int hook_open(struct tracy_event *e, int argpos, bool resolve_symlinks)
 			ERROR("%s: no bind for %s\n", __func__, path);
 			goto out;
 		}
-		// check fs now
-		// to update the last_checked timestamp
-		check_fs_nomount(fstabrec->stub_device);
+		// format detection compares s_lastcheck, so it has to be set.
+		// a forced check does that, but clean filesystems don't need it
+		if (fs_check_state(fstabrec->stub_device, fstabrec->fs_type)
+		    != FS_STATE_CLEAN)
+			check_fs_nomount(fstabrec->stub_device);
 
 		mbc->handled_by_open = 1;
 
 		// store path for post_syscall
 		mbc->tmp = path;
+		mbc->tmp_cloexec = !!(flags & O_CLOEXEC);
 	}
 
 	else if (mbc->handled_by_open) {
@@ -251,7 +403,8 @@ static int hook_open(struct tracy_event *e, int argpos, bool resolve_symlinks)
 				    make_fdinfo(e->child, fd, mbc->tmp);
 
 				if (fdi)
-					ll_add(mbc->files, fd, fdi);
+					fd_table_set(&mbc->files, fd, fdi,
+						     mbc->tmp_cloexec);
 				else {
 					ERROR("Couldn't make fdinfo for %s!\n",
 					      mbc->tmp);
@@ -298,11 +451,14 @@ static int redirect_file_access(struct tracy_event *e, int argpos,
 	if (e->child->pre_syscall) {
 		// get path
 		argptr = &e->args.a0;
-		path = get_patharg(e->child, argptr[argpos], resolve_symlinks);
-		if (!path) {
+		if (get_patharg_filtered(e->child, argptr[argpos],
+					 resolve_symlinks, devpath_filter,
+					 &path)) {
 			rc = TRACY_HOOK_ABORT;
 			goto out;
 		}
+		if (!path)
+			goto out;
 		// check if we need to redirect this file
 		fstabrec = get_fstab_rec(path);
 		if (!fstabrec) {
@@ -368,10 +524,9 @@ static int hook_close(struct tracy_event *e)
 
 	if (e->child->pre_syscall) {
 		int fd = (int)e->args.a0;
-		struct tracy_ll_item *item = ll_find(mbc->files, fd);
+		struct fd_info *fdi = fd_table_remove(&mbc->files, fd);
 
-		if (item) {
-			struct fd_info *fdi = item->data;
+		if (fdi) {
 			ERROR("close(%d|%s)\n", fd, fdi->filename);
 
 			// TODO detect format
@@ -389,8 +544,7 @@ static int hook_close(struct tracy_event *e)
 				}
 			}
 
-			free_fdinfo(fdi);
-			ll_del(mbc->files, fd);
+			drop_fdinfo(fd, fdi, NULL);
 		}
 	}
 
@@ -405,10 +559,14 @@ static int hook_dup(struct tracy_event *e)
 	if (e->child->pre_syscall) {
 		int fd = (int)e->args.a0;
 
-		struct tracy_ll_item *item = ll_find(mbc->files, fd);
-		if (item) {
-			struct fd_info *fdi = item->data;
+		struct fd_info *fdi = fd_table_get(&mbc->files, fd);
+		if (fdi) {
 			mbc->tmp = strdup(fdi->filename);
+
+			// only dup3 can set O_CLOEXEC
+			mbc->tmp_cloexec = e->syscall_num ==
+			    get_syscall_number_abi("dup3", e->abi)
+			    && (e->args.a2 & O_CLOEXEC);
 		}
 	}
 
@@ -419,13 +577,17 @@ static int hook_dup(struct tracy_event *e)
 			DEBUG("dup(%s) = %d\n", mbc->tmp, fd);
 
 			if (fd >= 0) {
-				struct fd_info *fdi =
-				    make_fdinfo(e->child, fd, mbc->tmp);
+				struct fd_info *fdi;
+
+				// dup2/dup3 closed the old target fd
+				fdi = fd_table_remove(&mbc->files, fd);
+				if (fdi)
+					drop_fdinfo(fd, fdi, NULL);
 
+				fdi = make_fdinfo(e->child, fd, mbc->tmp);
 				if (fdi)
-					ll_add(mbc->files, fd,
-					       make_fdinfo(e->child, fd,
-							   mbc->tmp));
+					fd_table_set(&mbc->files, fd, fdi,
+						     mbc->tmp_cloexec);
 				else {
 					ERROR("Couldn't make fdinfo for %s!\n",
 					      mbc->tmp);
@@ -450,10 +612,18 @@ static int hook_fcntl(struct tracy_event *e)
 
 	if (e->child->pre_syscall) {
 		int fd = (int)e->args.a0;
-
-		struct tracy_ll_item *item = ll_find(mbc->files, fd);
-		if (item) {
-			struct fd_info *fdi = item->data;
+		int cmd = (int)e->args.a1;
+
+		struct fd_info *fdi = fd_table_get(&mbc->files, fd);
+		if (fdi) {
+			// keep track of FD_CLOEXEC for execve
+			if (cmd == F_SETFD) {
+				fd_table_set_cloexec(&mbc->files, fd,
+						     e->args.a2 & FD_CLOEXEC);
+				return rc;
+			}
+			if (cmd == F_GETFD)
+				return rc;
 
 			// TODO handle switiching access mode
 			ERROR("fcntl(%d|%s)\n", fd, fdi->filename);
@@ -535,6 +705,10 @@ static int hook_mount(struct tracy_event *e)
 			free_patharg(e->child, mbc->memory);
 			mbc->memory = NULL;
 		}
+
+		// mounts can hide or change symlinks
+		if (e->args.return_code == 0)
+			path_cache_flush();
 	}
 
 out:
@@ -548,6 +722,120 @@ out:
 	return rc;
 }
 
+/*
+ * These change what a path resolves to
+ */
+static int hook_path_change(struct tracy_event *e)
+{
+	if (!e->child->pre_syscall && e->args.return_code == 0)
+		path_cache_flush();
+
+	return TRACY_HOOK_CONTINUE;
+}
+
+/*
+ * fd tables of new children which weren't created when their parent
+ * returned from fork
+ */
+static struct tracy_ll *pending_fd_tables;
+
+static void pending_fd_table_drop(pid_t pid)
+{
+	struct tracy_ll_item *item = ll_find(pending_fd_tables, pid);
+	struct fd_table *table;
+
+	if (!item)
+		return;
+
+	table = item->data;
+	fd_table_free(table, drop_fdinfo, NULL);
+	free(table);
+	ll_del(pending_fd_tables, pid);
+}
+
+static int hook_fork(struct tracy_event *e)
+{
+	struct multiboot_child_data *mbc = e->child->custom;
+	pid_t pid = (pid_t) e->args.return_code;
+	struct tracy_ll_item *item;
+	struct fd_table *table;
+
+	if (e->child->pre_syscall || pid <= 0)
+		return TRACY_HOOK_CONTINUE;
+
+	// threads share the fd table with their parent
+	if (e->syscall_num == get_syscall_number_abi("clone", e->abi)
+	    && (e->args.a0 & CLONE_FILES))
+		return TRACY_HOOK_CONTINUE;
+
+	// the child may be running already, its own entries are newer
+	item = ll_find(e->child->tracy->childs, pid);
+	if (item && item->data && ((struct tracy_child *)item->data)->custom) {
+		struct tracy_child *child = item->data;
+		struct multiboot_child_data *mbc_child = child->custom;
+
+		if (fd_table_copy(&mbc_child->files, &mbc->files, copy_fdinfo,
+				  drop_fdinfo_copy, child))
+			ERROR("%s: couldn't copy fd table to %d\n", __func__,
+			      pid);
+		return TRACY_HOOK_CONTINUE;
+	}
+
+	// a stale table of a previous process with this pid
+	pending_fd_table_drop(pid);
+
+	table = malloc(sizeof(struct fd_table));
+	if (!table)
+		return TRACY_HOOK_CONTINUE;
+
+	fd_table_init(table);
+	if (fd_table_copy(table, &mbc->files, copy_fdinfo, drop_fdinfo_copy,
+			  NULL) || ll_add(pending_fd_tables, pid, table)) {
+		ERROR("%s: couldn't copy fd table to %d\n", __func__, pid);
+		fd_table_free(table, drop_fdinfo, NULL);
+		free(table);
+	}
+
+	return TRACY_HOOK_CONTINUE;
+}
+
+/*
+ * children tracy never saw don't get their pending fd table,
+ * drop it once the parent reaped them
+ */
+static int hook_wait(struct tracy_event *e)
+{
+	pid_t pid = (pid_t) e->args.return_code;
+
+	if (!e->child->pre_syscall && pid > 0)
+		pending_fd_table_drop(pid);
+
+	return TRACY_HOOK_CONTINUE;
+}
+
+static int hook_execve(struct tracy_event *e)
+{
+	struct multiboot_child_data *mbc = e->child->custom;
+
+	if (!e->child->pre_syscall && e->args.return_code == 0) {
+		// the new image doesn't have our scratch arena
+		scratch_invalidate(e->child);
+
+		// FD_CLOEXEC files got closed
+		fd_table_drop_cloexec(&mbc->files, drop_fdinfo, NULL);
+	}
+
+	return TRACY_HOOK_CONTINUE;
+}
+
+static int fsr_fstab_init(struct module_data *data)
+{
+	if (rec_index_build(data))
+		return -1;
+
+	return devpath_filter_build();
+}
+
 static int fsr_tracy_init(struct module_data *data)
 {
 	unsigned i;
@@ -580,6 +868,29 @@ static int fsr_tracy_init(struct module_data *data)
 	// mount
 	do_hook(mount, hook_mount);
 
+	// fork
+	do_hook(fork, hook_fork);
+	do_hook(vfork, hook_fork);
+	do_hook(clone, hook_fork);
+	do_hook(wait4, hook_wait);
+
+	// exec
+	do_hook(execve, hook_execve);
+
+	// path cache invalidation
+	do_hook(symlink, hook_path_change);
+	do_hook(symlinkat, hook_path_change);
+	do_hook(rename, hook_path_change);
+	do_hook(renameat, hook_path_change);
+	do_hook(unlink, hook_path_change);
+	do_hook(unlinkat, hook_path_change);
+	do_hook(umount2, hook_path_change);
+
+	pending_fd_tables = ll_init();
+	if (!pending_fd_tables) {
+		ERROR("Couldn't allocate pending_fd_tables!\n");
+		return -1;
+	}
 	// prepate asec_rec
 	asec_rec = calloc(sizeof(asec_rec[0]), 1);
 	asec_rec->replacement_bind = 0;
@@ -600,13 +911,21 @@ static int fsr_tracy_child_create(struct module_data
 				  struct tracy_child *child)
 {
 	struct multiboot_child_data *mbc = child->custom;
+	struct tracy_ll_item *item;
 	DEBUG("%s\n", __func__);
 
-	// create list
-	mbc->files = ll_init();
-	if (!mbc->files) {
-		ERROR("Couldn't allocate mbc->files!\n");
-		return -1;
+	fd_table_init(&mbc->files);
+
+	// inherit files from our parent
+	item = ll_find(pending_fd_tables, child->pid);
+	if (item) {
+		struct fd_table *table = item->data;
+
+		mbc->files = *table;
+		fd_table_foreach(&mbc->files, set_fdinfo_child, child);
+
+		free(table);
+		ll_del(pending_fd_tables, child->pid);
 	}
 
 	return 0;
@@ -618,14 +937,15 @@ static int fsr_tracy_child_destroy(struct module_data
 {
 	struct multiboot_child_data *mbc = child->custom;
 	DEBUG("%s\n", __func__);
-	// free list
-	free_fdinfo_list(mbc->files);
-	mbc->files = NULL;
+	// free table
+	fd_table_free(&mbc->files, drop_fdinfo, "unclosed");
+	pending_fd_table_drop(child->pid);
 
 	return 0;
 }
 
 static struct module module_fs_redirection = {
+	.fstab_init = fsr_fstab_init,
 	.tracy_init = fsr_tracy_init,
 	.tracy_child_create = fsr_tracy_child_create,
 	.tracy_child_destroy = fsr_tracy_child_destroy,
@@ -59,10 +59,7 @@ static int patch_fstab(struct module_data *data, int index)
 				WARNING
 				    ("Couldn't find event_info for path %s!\n",
 				     blk_device);
-			} else if (event->linux_major ==
-				   data->grub_blockinfo->linux_major
-				   && event->linux_minor ==
-				   data->grub_blockinfo->linux_minor) {
+			} else if (event == data->grub_blockinfo) {
 				blk_device = PATH_MOUNTPOINT_GRUB;
 				fs_options = "bind";
 			}
@@ -130,8 +130,8 @@ static void import_kernel_nv(char *name)
 		chmod("/sbin/ums.sh", 0700);
 
 		// patch init.rc
-		sed_replace("/init.rc",
-			    "s/\\/sbin\\/recovery/\\/sbin\\/ums.sh/g");
+		rc_patch_add("/init.rc", "/sbin/recovery", "/sbin/ums.sh", 0);
+		rc_patch_apply();
 
 		// run init
 		if (run_init(NULL)) {
@@ -236,6 +236,7 @@ static int find_fstab(int (*callback) (const char *))
 
 static int add_fstab(const char *path)
 {
+	struct fstab **fstabs;
 	struct fstab *fstab = fs_mgr_read_fstab(path);
 	if (!fstab) {
 		ERROR("failed to load %s\n", path);
@@ -246,15 +247,16 @@ static int add_fstab(const char *path)
 		}
 	}
 	// allocate memory
-	module_data.target_fstabs =
-	    realloc(module_data.target_fstabs,
-		    ++module_data.target_fstabs_count);
-	if (!module_data.target_fstabs) {
+	fstabs = realloc(module_data.target_fstabs,
+			 (module_data.target_fstabs_count +
+			  1) * sizeof(fstabs[0]));
+	if (!fstabs) {
 		kperror("realloc");
 		return -1;
 	}
 	// add fstab
-	module_data.target_fstabs[module_data.target_fstabs_count - 1] = fstab;
+	module_data.target_fstabs = fstabs;
+	module_data.target_fstabs[module_data.target_fstabs_count++] = fstab;
 
 	return 0;
 }
@@ -266,6 +268,90 @@ static int system_is_recovery(void)
 	return !stat(FILE_RECOVERY_BINARY, &sb);
 }
 
+static int stage_block_devices(struct module_data *data)
+{
+	int rc = 0;
+
+	// queue uevents of devices showing up during the scan
+	if (uevent_listener_init())
+		WARNING("can't open uevent socket: %s\n", strerror(errno));
+
+	// mount sysfs
+	mkdir("/sys", 0755);
+	mount("sysfs", "/sys", "sysfs", 0, NULL);
+
+	data->block_info = get_block_devices();
+	if (!data->block_info) {
+		ERROR("Couldn't get block_info!\n");
+		rc = -1;
+		goto unmount_sysfs;
+	}
+	// get grub blockinfo
+	if (data->grub_device.blk_device && data->grub_path) {
+		data->grub_blockinfo =
+		    get_blockinfo_for_path(data->block_info,
+					   data->grub_device.blk_device);
+		if (!data->grub_blockinfo)
+			rc = -1;
+	}
+
+unmount_sysfs:
+	umount("/sys");
+	return rc;
+}
+
+static int stage_dev_nodes(struct module_data *data)
+{
+	// setup /multiboot/dev/block
+	uevent_create_nodes(data->block_info, PATH_MOUNTPOINT_DEV);
+	return 0;
+}
+
+static int stage_early_init(struct module_data *data)
+{
+	return modules_call_early_init(data);
+}
+
+static int stage_multiboot_fstab(struct module_data *data)
+{
+	(void)data;
+	return load_multiboot_fstab();
+}
+
+static int stage_target_fstabs(struct module_data *data)
+{
+	(void)data;
+	return find_fstab(&add_fstab);
+}
+
+static int stage_prepare_fstab(struct module_data *data)
+{
+	(void)data;
+	// fill fstabs with more info
+	return prepare_fstab();
+}
+
+/*
+ * the multiboot fstab is read from the bootloader directly, so it doesn't
+ * have to wait for the copy or the checked and mounted source partition.
+ * prepare_fstab replaces the blk_device strings grub_mount and source_mount
+ * build their mount paths from, so it has to run after both
+ */
+static const struct init_stage setup_stages[] = {
+	{"block_devices", stage_block_devices, 0, INIT_RES_BLOCK_INFO},
+	{"dev_nodes", stage_dev_nodes, INIT_RES_BLOCK_INFO, INIT_RES_DEV_NODES},
+	{"early_init", stage_early_init,
+	 INIT_RES_BLOCK_INFO | INIT_RES_DEV_NODES, INIT_RES_EARLY_INIT},
+	{"multiboot_fstab", stage_multiboot_fstab,
+	 INIT_RES_BOOTLOADER | INIT_RES_DEV_NODES, INIT_RES_MULTIBOOT_FSTAB},
+	{"target_fstabs", stage_target_fstabs, 0, INIT_RES_TARGET_FSTABS},
+	{"prepare_fstab", stage_prepare_fstab,
+	 INIT_RES_BLOCK_INFO | INIT_RES_BOOTLOADER | INIT_RES_SOURCE |
+	 INIT_RES_EARLY_INIT | INIT_RES_MULTIBOOT_FSTAB |
+	 INIT_RES_TARGET_FSTABS, 0},
+	{NULL, NULL, 0, 0},
+};
+
 static int setup(void)
 {
 	int rc = 0;
@@ -314,50 +400,10 @@ static int setup(void)
 	}
 	// !MULTIBOOT && !2NDSTAGE IS IMPOSSIBLE FROM HERE
 
-	// mount sysfs
-	mkdir("/sys", 0755);
-	mount("sysfs", "/sys", "sysfs", 0, NULL);
-
-	module_data.block_info = get_block_devices();
-	if (!module_data.block_info) {
-		ERROR("Couldn't get block_info!\n");
-		rc = -1;
-		goto unmount_procfs;
-	}
-	// unmount sysfs
-	umount("/sys");
-
-	// setup /multiboot/dev/block
-	uevent_create_nodes(module_data.block_info, PATH_MOUNTPOINT_DEV);
-
-	// get grub blockinfo
-	if (module_data.grub_device.blk_device && module_data.grub_path) {
-		module_data.grub_blockinfo =
-		    get_blockinfo_for_path(module_data.block_info,
-					   module_data.grub_device.blk_device);
-		if (!module_data.grub_blockinfo) {
-			rc = -1;
-			goto unmount_procfs;
-		}
-	}
 	// early init
 	module_data.initstage = INITSTAGE_EARLY;
-	if (modules_call_early_init(&module_data)) {
-		rc = -1;
-		goto unmount_procfs;
-	}
-	// load multiboot fstab
-	if (load_multiboot_fstab()) {
-		rc = -1;
-		goto unmount_procfs;
-	}
-	// load target fstabs
-	if (find_fstab(&add_fstab)) {
-		rc = -1;
-		goto unmount_procfs;
-	}
-	// fill fstabs with more info
-	if (prepare_fstab()) {
+	if (init_graph_add_stages(setup_stages) || modules_add_stages()
+	    || init_graph_run(&module_data)) {
 		rc = -1;
 		goto unmount_procfs;
 	}
@@ -368,6 +414,9 @@ static int setup(void)
 		rc = -1;
 		goto unmount_procfs;
 	}
+	// patch rc files
+	if (rc_patch_apply())
+		ERROR("error patching rc files!\n");
 
 unmount_procfs:
 	// unmount procfs
@@ -542,6 +591,12 @@ int main(int argc, char **argv)
 	}
 	// !MULTIBOOT && !2NDSTAGE IS IMPOSSIBLE FROM HERE
 
+	// keep block_info up to date, e.g. for sd cards
+	if (module_data.block_info
+	    && uevent_listener_start(module_data.block_info,
+				     PATH_MOUNTPOINT_DEV))
+		WARNING("can't start uevent listener: %s\n", strerror(errno));
+
 	// tracy init
 	tracy_opt |= TRACY_TRACE_CHILDREN;
 	module_data.tracy = tracy = tracy_init(tracy_opt);
@@ -0,0 +1,373 @@
+#include <common.h>
+#include <regex.h>
+
+/*
+ * in-process replacement for `sed -i'
+ *
+ * Rules get registered during early init and are applied in one go, so
+ * every patched file is read, rewritten and renamed into place only once,
+ * no matter how many rules target it.
+ */
+
+#define MAX_RC_PATCH_RULES 32
+
+struct rc_rule {
+	char *file;
+	char *pattern;
+	char *replacement;
+	size_t pattern_len;
+	size_t replacement_len;
+	unsigned flags;
+	regex_t regex;
+};
+
+struct strbuf {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+static struct rc_rule rc_rules[MAX_RC_PATCH_RULES];
+static unsigned rc_rules_count = 0;
+
+static int sb_append(struct strbuf *sb, const char *s, size_t len)
+{
+	if (sb->len + len + 1 > sb->size) {
+		size_t size = sb->size ? sb->size : 256;
+		char *data;
+
+		while (sb->len + len + 1 > size)
+			size *= 2;
+
+		data = realloc(sb->data, size);
+		if (!data)
+			return -1;
+		sb->data = data;
+		sb->size = size;
+	}
+
+	memcpy(sb->data + sb->len, s, len);
+	sb->len += len;
+	sb->data[sb->len] = '\0';
+
+	return 0;
+}
+
+static void free_rule(struct rc_rule *rule)
+{
+	if (rule->flags & RC_PATCH_REGEX)
+		regfree(&rule->regex);
+	free(rule->file);
+	free(rule->pattern);
+	free(rule->replacement);
+}
+
+int rc_patch_add(const char *file, const char *pattern,
+		 const char *replacement, unsigned flags)
+{
+	struct rc_rule *rule;
+	int rc;
+
+	if (rc_rules_count >= ARRAY_SIZE(rc_rules)) {
+		ERROR("%s: too many rules!\n", __func__);
+		return -1;
+	}
+
+	// rules work on single lines
+	if (!*pattern || strchr(pattern, '\n') || strchr(replacement, '\n')) {
+		ERROR("%s: invalid pattern '%s'\n", __func__, pattern);
+		return -1;
+	}
+
+	rule = &rc_rules[rc_rules_count];
+	memset(rule, 0, sizeof(rule[0]));
+
+	if (flags & RC_PATCH_REGEX) {
+		rc = regcomp(&rule->regex, pattern, 0);
+		if (rc) {
+			char err[128];
+
+			regerror(rc, &rule->regex, err, sizeof(err));
+			ERROR("%s: '%s': %s\n", __func__, pattern, err);
+			return -1;
+		}
+	}
+
+	rule->file = strdup(file);
+	rule->pattern = strdup(pattern);
+	rule->replacement = strdup(replacement);
+	rule->pattern_len = strlen(pattern);
+	rule->replacement_len = strlen(replacement);
+	rule->flags = flags;
+	if (!rule->file || !rule->pattern || !rule->replacement) {
+		free_rule(rule);
+		return -1;
+	}
+
+	rc_rules_count++;
+	return 0;
+}
+
+int rc_patch_add_rules(const struct rc_patch_rule *rules)
+{
+	for (; rules->file; rules++) {
+		if (rc_patch_add(rules->file, rules->pattern,
+				 rules->replacement, rules->flags))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * apply one rule to a nul-terminated line,
+ * returns the number of replacements or -1
+ */
+static int substitute(struct rc_rule *rule, const char *line, size_t len,
+		      struct strbuf *out)
+{
+	const char *p = line, *end = line + len;
+	int count = 0;
+
+	out->len = 0;
+
+	if (!(rule->flags & RC_PATCH_REGEX)) {
+		const char *match;
+
+		while ((match = strstr(p, rule->pattern))) {
+			if (sb_append(out, p, match - p) ||
+			    sb_append(out, rule->replacement,
+				      rule->replacement_len))
+				return -1;
+			p = match + rule->pattern_len;
+			count++;
+		}
+	} else {
+		bool adjacent = false;
+		regmatch_t m;
+		int eflags = 0;
+
+		while (p <= end && !regexec(&rule->regex, p, 1, &m, eflags)) {
+			bool empty = m.rm_eo == m.rm_so;
+
+			if (sb_append(out, p, m.rm_so))
+				return -1;
+
+			// like sed, no empty match right after the previous one
+			if (!empty || !adjacent || m.rm_so) {
+				if (sb_append(out, rule->replacement,
+					      rule->replacement_len))
+					return -1;
+				count++;
+			}
+
+			// step over empty matches
+			if (empty) {
+				if (p + m.rm_eo == end) {
+					p = end;
+					break;
+				}
+				if (sb_append(out, p + m.rm_eo, 1))
+					return -1;
+				p += m.rm_eo + 1;
+			} else {
+				p += m.rm_eo;
+			}
+			adjacent = !empty;
+			eflags = REG_NOTBOL;
+		}
+	}
+
+	if (count && sb_append(out, p, end - p))
+		return -1;
+
+	return count;
+}
+
+static char *read_file(const char *file, struct stat *st)
+{
+	char *buf;
+	size_t pos = 0;
+	int fd;
+
+	fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, st)) {
+		close(fd);
+		return NULL;
+	}
+
+	buf = malloc(st->st_size + 1);
+	if (!buf) {
+		close(fd);
+		return NULL;
+	}
+
+	while (pos < (size_t)st->st_size) {
+		ssize_t n = read(fd, buf + pos, st->st_size - pos);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		pos += n;
+	}
+	close(fd);
+
+	buf[pos] = '\0';
+	st->st_size = pos;
+
+	return buf;
+}
+
+/*
+ * write to a temporary file next to the target and rename it over
+ */
+static int write_file(const char *file, const struct strbuf *sb,
+		      mode_t mode)
+{
+	char tmp[PATH_MAX];
+	size_t pos = 0;
+	int fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.rc_patch", file) >= (int)sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+	if (fd < 0)
+		return -1;
+
+	while (pos < sb->len) {
+		ssize_t n = write(fd, sb->data + pos, sb->len - pos);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			break;
+		pos += n;
+	}
+
+	// the umask could have changed the mode
+	if (pos < sb->len || fchmod(fd, mode)) {
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+
+	if (close(fd) || rename(tmp, file)) {
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int patch_file(const char *file, struct rc_rule **rules,
+		      unsigned count)
+{
+	struct strbuf result = { 0 }, bufs[2] = { {0}, {0} };
+	struct stat st;
+	char *data, *line, *next;
+	int replaced = 0, rc = -1;
+	unsigned i;
+
+	data = read_file(file, &st);
+	// not every device has all the files we know how to patch
+	if (!data && errno == ENOENT)
+		return 0;
+	if (!data) {
+		ERROR("%s: can't read %s: %s\n", __func__, file,
+		      strerror(errno));
+		return -1;
+	}
+
+	for (line = data; *line; line = next) {
+		struct strbuf *cur = NULL;
+		const char *s = line;
+		bool newline;
+		size_t len;
+
+		next = strchr(line, '\n');
+		newline = next != NULL;
+		if (newline)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+		len = strlen(line);
+
+		// rules see the output of the previous ones, like `sed -e -e'
+		for (i = 0; i < count; i++) {
+			struct strbuf *out = &bufs[cur == &bufs[0]];
+			int n = substitute(rules[i], s, len, out);
+
+			if (n < 0)
+				goto out;
+			if (!n)
+				continue;
+
+			replaced += n;
+			cur = out;
+			s = cur->data;
+			len = cur->len;
+		}
+
+		if (sb_append(&result, s, len) ||
+		    (newline && sb_append(&result, "\n", 1)))
+			goto out;
+	}
+
+	if (!replaced) {
+		rc = 0;
+		goto out;
+	}
+
+	rc = write_file(file, &result, st.st_mode & 07777);
+	if (rc)
+		ERROR("%s: can't write %s: %s\n", __func__, file,
+		      strerror(errno));
+	else
+		INFO("%s: %s: %d replacements\n", __func__, file, replaced);
+
+out:
+	free(bufs[0].data);
+	free(bufs[1].data);
+	free(result.data);
+	free(data);
+	return rc;
+}
+
+/*
+ * apply and drop all registered rules
+ */
+int rc_patch_apply(void)
+{
+	struct rc_rule *rules[MAX_RC_PATCH_RULES];
+	bool done[MAX_RC_PATCH_RULES] = { false };
+	unsigned i, j, count;
+	int rc = 0;
+
+	for (i = 0; i < rc_rules_count; i++) {
+		if (done[i])
+			continue;
+
+		// all rules for this file, in the order they were added
+		count = 0;
+		for (j = i; j < rc_rules_count; j++) {
+			if (!done[j] && !strcmp(rc_rules[j].file, rc_rules[i].file)) {
+				rules[count++] = &rc_rules[j];
+				done[j] = true;
+			}
+		}
+
+		if (patch_file(rc_rules[i].file, rules, count))
+			rc = -1;
+	}
+
+	for (i = 0; i < rc_rules_count; i++)
+		free_rule(&rc_rules[i]);
+	rc_rules_count = 0;
+
+	return rc;
+}
@@ -1,7 +1,19 @@
 #include <common.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <loopdev.h>
+
+#define PATH_LOOP_CONTROL PATH_MOUNTPOINT_DEV "/loop-control"
 
 static const size_t block_size = 512;
 
+// createRawImage
+#define COPY_ALIGN 4096
+#define COPY_BUF_SIZE (1024 * 1024)
+#define COPY_ZERO_CHUNK (64 * 1024)
+#define COPY_RANGE_MAX (64 * 1024 * 1024)
+
 /*
  * Source: http://stackoverflow.com/questions/15545341/process-name-from-its-pid-in-linux
  */
@@ -98,26 +110,104 @@ int util_mount(const char *source, const char *target,
 	return mount(source, target, filesystemtype, mountflags, data);
 }
 
+static int loop_control(void)
+{
+	static int fd = -1;
+
+	if (fd >= 0)
+		return fd;
+
+	// the private dev has no loop-control node until we need one
+	if (mknod(PATH_LOOP_CONTROL, S_IRUSR | S_IWUSR | S_IFCHR,
+		  makedev(10, 237)) && errno != EEXIST)
+		return -1;
+
+	fd = open(PATH_LOOP_CONTROL, O_RDWR | O_CLOEXEC);
+	return fd;
+}
+
+static bool loop_is_bound(const char *path)
+{
+	struct loop_info64 info;
+	bool bound;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	bound = !ioctl(fd, LOOP_GET_STATUS64, &info);
+	close(fd);
+	return bound;
+}
+
 char *make_loop(const char *path)
 {
 	static int loops_created = 0;
 
 	char buf[PATH_MAX];
-	int minor = 255 - loops_created;
+	int ctl = loop_control();
 
-	if (!path) {
-		snprintf(buf, ARRAY_SIZE(buf),
-			 PATH_MOUNTPOINT_DEV "/block/loop%d", minor);
-		path = buf;
-	}
+	for (; loops_created < 256; loops_created++) {
+		int minor = 255 - loops_created;
 
-	if (mknod(path, S_IRUSR | S_IWUSR | S_IFBLK, makedev(7, minor))) {
-		kperror("mknod");
-		return NULL;
+		if (path)
+			strlcpy(buf, path, sizeof(buf));
+		else
+			snprintf(buf, ARRAY_SIZE(buf),
+				 PATH_MOUNTPOINT_DEV "/block/loop%d", minor);
+
+		// max_loop may be lower than the minors we hand out
+		if (ctl >= 0 && ioctl(ctl, LOOP_CTL_ADD, minor) < 0
+		    && errno != EEXIST)
+			WARNING("LOOP_CTL_ADD(%d): %s\n", minor,
+				strerror(errno));
+
+		if (mknod(buf, S_IRUSR | S_IWUSR | S_IFBLK, makedev(7, minor))) {
+			kperror("mknod");
+			return NULL;
+		}
+
+		// someone else already uses this one
+		if (loop_is_bound(buf)) {
+			unlink(buf);
+			continue;
+		}
+
+		loops_created++;
+		return strdup(buf);
 	}
 
-	loops_created++;
-	return strdup(buf);
+	ERROR("no free loop minor left\n");
+	return NULL;
+}
+
+/*
+ * point an existing loop node to a free minor.
+ * the path has to stay the same because it's in the fstab already
+ */
+static int rebind_loop(const char *device)
+{
+	struct stat sb;
+	int ctl, free_minor;
+
+	ctl = loop_control();
+	if (ctl < 0)
+		return -1;
+
+	free_minor = ioctl(ctl, LOOP_CTL_GET_FREE);
+	if (free_minor < 0)
+		return -1;
+
+	if (!stat(device, &sb) && (int)minor(sb.st_rdev) == free_minor)
+		return -1;
+
+	unlink(device);
+	if (mknod(device, S_IRUSR | S_IWUSR | S_IFBLK, makedev(7, free_minor)))
+		return -1;
+
+	INFO("%s: rebound to loop%d\n", device, free_minor);
+	return 0;
 }
 
 /*
@@ -200,27 +290,58 @@ strlcpy(char *dst,		/* O - Destination string */
 }
 #endif /* !HAVE_STRLCPY */
 
-char *get_patharg(struct tracy_child *child, long addr, int real)
+/* bytes to read before checking the path prefix */
+#define PATHARG_PREFETCH 64
+
+/*
+ * Read up to 'len' bytes from the child. Reads never cross a page boundary,
+ * so strings which end right before an unmapped page can be read, too.
+ * Returns the number of bytes read, which may be less than 'len'.
+ */
+static ssize_t read_child_chunk(struct tracy_child *child, char *dst,
+				long addr, size_t len)
+{
+	size_t pagesize = getpagesize();
+	size_t page_left = pagesize - (addr & (pagesize - 1));
+	struct iovec local, remote;
+	ssize_t rc;
+
+	if (len > page_left)
+		len = page_left;
+
+	local.iov_base = dst;
+	local.iov_len = len;
+	remote.iov_base = (void *)addr;
+	remote.iov_len = len;
+
+	rc = syscall(__NR_process_vm_readv, child->pid, &local, 1, &remote, 1,
+		     0);
+	if (rc < 0 && errno == ENOSYS) {
+		if (tracy_read_mem(child, dst, (void *)addr, len) < 0)
+			return -1;
+		rc = len;
+	}
+
+	return rc;
+}
+
+static char *resolve_patharg(const char *path, int real)
 {
-	static const int len = PATH_MAX;
-	char path[PATH_MAX];
 	struct stat sb;
+	const char *cached;
 
-	// read string
-	memset(path, 0, len);
-	if (tracy_read_mem(child, path, (void *)addr, len) < 0) {
-		kperror("tracy_read_mem");
-		return NULL;
-	}
+	// resolved this one before
+	if (real && (cached = path_cache_lookup(path)))
+		return strdup(cached);
 
 	if (real && !stat(path, &sb)) {
-		char *path_real = malloc(PATH_MAX);
-		memset(path_real, 0, len);
+		char *path_real = calloc(PATH_MAX, 1);
 
 		// resolve symlinks
-		if (realpath(path, path_real) != NULL && !errno)
+		if (path_real && realpath(path, path_real) != NULL) {
+			path_cache_insert(path, path_real);
 			return path_real;
-		else
+		} else
 			free(path_real);
 	} else {
 		return strdup(path);
@@ -230,34 +351,133 @@ char *get_patharg(struct tracy_child *child, long addr, int real)
 	return NULL;
 }
 
+/*
+ * Read a path argument from the child.
+ *
+ * If 'filter' is set, only a small chunk gets read first and the path is
+ * rejected early if it doesn't start with one of the filter's prefixes.
+ * In that case 0 is returned and *result is NULL.
+ */
+int get_patharg_filtered(struct tracy_child *child, long addr, int real,
+			 const struct path_trie *filter, char **result)
+{
+	char path[PATH_MAX];
+	size_t len = 0;
+	bool terminated;
+
+	*result = NULL;
+
+	do {
+		size_t want = (filter && !len) ? PATHARG_PREFETCH :
+		    sizeof(path) - len;
+		ssize_t rc = read_child_chunk(child, path + len, addr + len,
+					      want);
+		if (rc <= 0) {
+			// the syscall will fail with EFAULT anyway
+			if (filter && rc < 0 && errno == EFAULT)
+				return 0;
+
+			kperror("read_child_chunk");
+			return -1;
+		}
+
+		terminated = memchr(path + len, '\0', rc) != NULL;
+		len += rc;
+
+		// this can't be a device we redirect
+		if (filter && !path_trie_match(filter, path, len))
+			return 0;
+
+		if (!terminated && len >= sizeof(path)) {
+			ERROR("%s: path is too long!\n", __func__);
+			return -1;
+		}
+	} while (!terminated);
+
+	*result = resolve_patharg(path, real);
+	return *result ? 0 : -1;
+}
+
+char *get_patharg(struct tracy_child *child, long addr, int real)
+{
+	char *path;
+
+	if (get_patharg_filtered(child, addr, real, NULL, &path))
+		return NULL;
+
+	return path;
+}
+
+/*
+ * Every traced child gets a small scratch arena which holds rewritten path
+ * arguments. It gets mapped on first use and stays mapped until the child
+ * exits or exec's, so redirecting a syscall doesn't need remote mmap/munmap.
+ */
+static int scratch_alloc(struct tracy_child *child)
+{
+	struct multiboot_child_data *mbc = child->custom;
+	long rc;
+
+	rc = tracy_mmap(child, &mbc->scratch, NULL, SCRATCH_SIZE,
+			PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (rc < 0 || !mbc->scratch) {
+		mbc->scratch = NULL;
+		return -1;
+	}
+
+	mbc->scratch_used = 0;
+	return 0;
+}
+
+/*
+ * The old address space is gone after a successful execve
+ */
+void scratch_invalidate(struct tracy_child *child)
+{
+	struct multiboot_child_data *mbc = child->custom;
+
+	mbc->scratch = NULL;
+	mbc->scratch_used = 0;
+	mbc->memory = NULL;
+}
+
 tracy_child_addr_t copy_patharg(struct tracy_child * child, const char *path)
 {
+	struct multiboot_child_data *mbc = child->custom;
+	size_t len = strlen(path) + 1;
+	tracy_child_addr_t path_new;
+	unsigned slot;
 	long rc;
-	int len = strlen(path) + 1;
-	tracy_child_addr_t path_new = NULL;
 
-	if (len > PATH_MAX + 1) {
+	if (len > SCRATCH_SLOT_SIZE) {
 		ERROR("%s: path is too long!\n", __func__);
 		goto err;
 	}
-	// allocate memory for new devname
-	rc = tracy_mmap(child, &path_new, NULL, PATH_MAX + 1,
-			PROT_READ | PROT_WRITE,
-			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	if (rc < 0 || !path_new) {
+	// map scratch arena
+	if (!mbc->scratch && scratch_alloc(child)) {
 		goto err;
 	}
+	// find free slot
+	for (slot = 0; slot < SCRATCH_SLOTS; slot++) {
+		if (!(mbc->scratch_used & (1u << slot)))
+			break;
+	}
+	if (slot == SCRATCH_SLOTS) {
+		ERROR("%s: no free scratch slot!\n", __func__);
+		goto err;
+	}
+	path_new = (char *)mbc->scratch + slot * SCRATCH_SLOT_SIZE;
+
 	// copy new devname
-	rc = tracy_write_mem(child, path_new, (char *)path,
-			     (size_t) strlen(path) + 1);
+	rc = tracy_write_mem(child, path_new, (char *)path, len);
 	if (rc < 0) {
-		goto err_munmap;
+		goto err;
 	}
 
+	mbc->scratch_used |= 1u << slot;
 	return path_new;
 
-err_munmap:
-	tracy_munmap(child, &rc, path_new, len);
 err:
 	ERROR("%s: Error copying patharg!\n", __func__);
 	return NULL;
@@ -265,24 +485,15 @@ err:
 
 void free_patharg(struct tracy_child *child, tracy_child_addr_t addr)
 {
-	long ret;
-	tracy_munmap(child, &ret, addr, PATH_MAX + 1);
-}
-
-static unsigned long get_blknum(const char *path)
-{
-	int fd;
-	unsigned long numblocks = 0;
+	struct multiboot_child_data *mbc = child->custom;
+	size_t offset = (char *)addr - (char *)mbc->scratch;
 
-	fd = open(path, O_RDONLY);
-	if (!fd)
-		return 0;
+	// arena got invalidated in between
+	if (!mbc->scratch || (char *)addr < (char *)mbc->scratch
+	    || offset >= SCRATCH_SIZE)
+		return;
 
-	if (ioctl(fd, BLKGETSIZE, &numblocks) == -1)
-		return 0;
-
-	close(fd);
-	return numblocks;
+	mbc->scratch_used &= ~(1u << (offset / SCRATCH_SLOT_SIZE));
 }
 
 int do_exec(char **args)
@@ -301,124 +512,349 @@ int do_exec(char **args)
 	return status;
 }
 
-int createRawImage(const char *source, const char *target, unsigned long blocks)
+static int get_fd_size(int fd, uint64_t * size)
 {
-	unsigned long numblocks = source ? get_blknum(source) : blocks;
-	char *par[64];
-	char buf[PATH_MAX];
-	int i = 0;
-	char *buf_if = NULL, *buf_of = NULL, *buf_bs = NULL, *buf_count = NULL;
-	int rc;
+	struct stat sb;
 
-	// tool
-	par[i++] = PATH_MULTIBOOT_BUSYBOX;
-	par[i++] = "dd";
+	if (fstat(fd, &sb))
+		return -1;
 
-	// input
-	if (source) {
-		snprintf(buf, ARRAY_SIZE(buf), "if=%s", source);
-		buf_if = strdup(buf);
-		par[i++] = buf_if;
-	} else
-		par[i++] = "if=" PATH_MOUNTPOINT_DEV "/zero";
+	if (S_ISBLK(sb.st_mode))
+		return ioctl(fd, BLKGETSIZE64, size) == -1 ? -1 : 0;
 
-	// output
-	snprintf(buf, ARRAY_SIZE(buf), "of=%s", target);
-	buf_of = strdup(buf);
-	par[i++] = buf_of;
+	*size = sb.st_size;
+	return 0;
+}
 
-	// blocksize
-	snprintf(buf, ARRAY_SIZE(buf), "bs=%d", block_size);
-	buf_bs = strdup(buf);
-	par[i++] = buf_bs;
+struct copy_progress {
+	const char *name;
+	uint64_t total;
+	uint64_t done;
+	int step;
+};
 
-	// count
-	snprintf(buf, ARRAY_SIZE(buf), "count=%lu", numblocks);
-	buf_count = strdup(buf);
-	par[i++] = buf_count;
+static void copy_progress_add(struct copy_progress *p, uint64_t n)
+{
+	int step;
 
-	// end
-	par[i++] = (char *)0;
+	p->done += n;
+	if (!p->total)
+		return;
 
-	// exec
-	rc = do_exec(par);
+	// report every 10%
+	step = p->done * 10 / p->total;
+	if (step == p->step)
+		return;
 
-	// cleanup
-	if (buf_if)
-		free(buf_if);
-	free(buf_of);
-	free(buf_bs);
-	free(buf_count);
+	p->step = step;
+	INFO("%s: %d%% (%llu/%llu MiB)\n", p->name, step * 10,
+	     (unsigned long long)(p->done >> 20),
+	     (unsigned long long)(p->total >> 20));
+}
 
-	return rc;
+static bool is_zero(const char *buf, size_t len)
+{
+	const unsigned long *p = (const unsigned long *)buf;
+	size_t i;
+
+	for (i = 0; i < len / sizeof(*p); i++)
+		if (p[i])
+			return false;
+
+	for (i *= sizeof(*p); i < len; i++)
+		if (buf[i])
+			return false;
+
+	return true;
 }
 
-int set_loop(char *device, char *file, int ro)
+static int pwrite_all(int fd, const char *buf, size_t len, off_t off)
 {
-	char *par[64];
-	int i = 0;
+	while (len) {
+		ssize_t n = pwrite(fd, buf, len, off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		off += n;
+		len -= n;
+	}
 
-	// tool
-	par[i++] = PATH_MULTIBOOT_BUSYBOX;
-	par[i++] = "losetup";
+	return 0;
+}
 
-	// access mode
-	if (ro)
-		par[i++] = "-r";
+/*
+ * in-kernel copy, returns the number of bytes copied.
+ * stops early if the kernel can't do it for this pair of files
+ */
+static uint64_t copy_range(int in, int out, off_t off, uint64_t len,
+			   struct copy_progress *progress, bool *supported)
+{
+	uint64_t copied = 0;
+
+#ifdef __NR_copy_file_range
+	while (*supported && copied < len) {
+		loff_t off_in = off + copied, off_out = off + copied;
+		size_t want = len - copied > COPY_RANGE_MAX ?
+		    COPY_RANGE_MAX : len - copied;
+		ssize_t n;
+
+		n = syscall(__NR_copy_file_range, in, &off_in, out, &off_out,
+			    want, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			*supported = false;
+			break;
+		}
 
-	// paths
-	par[i++] = device;
-	par[i++] = file;
+		copied += n;
+		copy_progress_add(progress, n);
+	}
+#else
+	(void)in;
+	(void)out;
+	(void)off;
+	(void)len;
+	(void)progress;
+	*supported = false;
+#endif
+
+	return copied;
+}
 
-	// end
-	par[i++] = (char *)0;
+/*
+ * copy through a userspace buffer so we can see the data.
+ * zeroed chunks aren't written, the target is pre-sized so they stay holes
+ */
+static int copy_buffered(int in, int out, off_t off, uint64_t len, char *buf,
+			 struct copy_progress *progress)
+{
+	while (len) {
+		size_t want = len > COPY_BUF_SIZE ? COPY_BUF_SIZE : len;
+		size_t pos, chunk;
+		ssize_t n;
+
+		n = pread(in, buf, want, off);
+		if (n < 0 && errno == EINVAL && (fcntl(in, F_GETFL) & O_DIRECT)) {
+			// the device doesn't like our alignment after all
+			if (fcntl(in, F_SETFL, fcntl(in, F_GETFL) & ~O_DIRECT))
+				return -1;
+			continue;
+		}
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)
+			break;
+
+		for (pos = 0; pos < (size_t)n; pos += chunk) {
+			chunk = n - pos > COPY_ZERO_CHUNK ?
+			    COPY_ZERO_CHUNK : n - pos;
+			if (is_zero(buf + pos, chunk))
+				continue;
+			if (pwrite_all(out, buf + pos, chunk, off + pos))
+				return -1;
+		}
 
-	return do_exec(par);
+		off += n;
+		len -= n;
+		copy_progress_add(progress, n);
+	}
+
+	return 0;
 }
 
-int util_copy(char *source, char *target, bool recursive, bool force)
+static int copy_image(int in, int out, uint64_t size,
+		      struct copy_progress *progress)
 {
-	char *par[64];
-	int i = 0;
+	bool use_copy_range = true;
+	char *buf = NULL;
+	off_t off, data, end;
+	uint64_t copied;
+	int rc = 0;
 
-	// tool
-	par[i++] = PATH_MULTIBOOT_BUSYBOX;
-	par[i++] = "cp";
+	posix_fadvise(in, 0, size, POSIX_FADV_SEQUENTIAL);
+
+	for (off = 0; (uint64_t)off < size; off = end) {
+		// only visit the data extents of sparse sources
+		data = lseek(in, off, SEEK_DATA);
+		if (data < 0 && errno == ENXIO)
+			break;
+		if (data < 0) {
+			data = off;
+			end = size;
+		} else {
+			end = lseek(in, data, SEEK_HOLE);
+			if (end < 0 || (uint64_t)end > size)
+				end = size;
+		}
+		if ((uint64_t)data >= size)
+			break;
+		copy_progress_add(progress, data - off);
+
+		copied = copy_range(in, out, data, end - data, progress,
+				    &use_copy_range);
+		if (data + copied == (uint64_t)end)
+			continue;
+
+		if (!buf && posix_memalign((void **)&buf, COPY_ALIGN,
+					   COPY_BUF_SIZE)) {
+			buf = NULL;
+			rc = -1;
+			break;
+		}
 
-	if (recursive)
-		par[i++] = "-R";
+		rc = copy_buffered(in, out, data + copied,
+				   end - data - copied, buf, progress);
+		if (rc)
+			break;
+	}
 
-	if (force)
-		par[i++] = "-f";
+	free(buf);
+	return rc;
+}
 
-	par[i++] = source;
-	par[i++] = target;
+int createRawImage(const char *source, const char *target, unsigned long blocks)
+{
+	struct copy_progress progress = {.name = target };
+	struct timespec start, now;
+	uint64_t size;
+	int in = -1, out, rc = -1, err;
 
-	// end
-	par[i++] = (char *)0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	return do_exec(par);
+	if (source) {
+		in = open(source, O_RDONLY | O_CLOEXEC | O_DIRECT);
+		if (in < 0 && errno == EINVAL)
+			in = open(source, O_RDONLY | O_CLOEXEC);
+		if (in < 0)
+			return -1;
+
+		if (get_fd_size(in, &size))
+			goto out_close_in;
+		if (blocks < size / block_size)
+			size = (uint64_t)blocks * block_size;
+	} else
+		size = (uint64_t)blocks * block_size;
+
+	out = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (out < 0)
+		goto out_close_in;
+
+	if (!source) {
+		// blank stubs don't need any data, just the space
+		rc = fallocate(out, 0, 0, size);
+		if (rc)
+			rc = ftruncate(out, size);
+	} else {
+		progress.total = size;
+		rc = ftruncate(out, size);
+		if (!rc)
+			rc = copy_image(in, out, size, &progress);
+	}
+
+	if (!rc)
+		rc = fsync(out);
+
+	err = errno;
+	close(out);
+	if (rc) {
+		// don't leave a partial image around for the next boot
+		unlink(target);
+		errno = err;
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		INFO("%s: %llu MiB in %ld ms\n", target,
+		     (unsigned long long)(size >> 20),
+		     (now.tv_sec - start.tv_sec) * 1000 +
+		     (now.tv_nsec - start.tv_nsec) / 1000000);
+	}
+
+out_close_in:
+	if (in >= 0) {
+		err = errno;
+		close(in);
+		errno = err;
+	}
+	return rc;
 }
 
-int util_chmod(char *path, char *mode, bool recursive)
+int setup_loop(const char *device, const char *file, uint64_t offset,
+	       uint64_t sizelimit, uint32_t lo_flags)
 {
-	char *par[64];
-	int i = 0;
+	struct loopdev_cxt lc;
+	int rc, tries = 0;
 
-	// tool
-	par[i++] = PATH_MULTIBOOT_BUSYBOX;
-	par[i++] = "chmod";
+	rc = loopcxt_init(&lc, 0);
+	if (rc)
+		goto out;
 
-	if (recursive)
-		par[i++] = "-R";
+	do {
+		// this resets the info, so it has to come first
+		rc = loopcxt_set_device(&lc, device);
+		if (rc)
+			break;
 
-	par[i++] = mode;
-	par[i++] = path;
+		rc = loopcxt_set_backing_file(&lc, file);
+		if (rc)
+			break;
 
-	// end
-	par[i++] = (char *)0;
+		if (offset && (rc = loopcxt_set_offset(&lc, offset)))
+			break;
+		if (sizelimit && (rc = loopcxt_set_sizelimit(&lc, sizelimit)))
+			break;
+		if ((rc = loopcxt_set_flags(&lc, lo_flags)))
+			break;
 
-	return do_exec(par);
+		rc = loopcxt_setup_device(&lc);
+	} while (rc == -EBUSY && tries++ == 0 && !rebind_loop(device));
+
+	loopcxt_deinit(&lc);
+
+out:
+	if (rc) {
+		errno = rc < 0 ? -rc : EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+int set_loop(char *device, char *file, int ro)
+{
+	return setup_loop(device, file, 0, 0, ro ? LO_FLAGS_READ_ONLY : 0);
+}
+
+int util_copy(char *source, char *target, bool recursive, bool force)
+{
+	char buf[PATH_MAX];
+	struct stat st;
+	char *name;
+
+	// like cp, copy into existing directories
+	if (!stat(target, &st) && S_ISDIR(st.st_mode)) {
+		name = strrchr(source, '/');
+		snprintf(buf, sizeof(buf), "%s/%s", target,
+			 name ? name + 1 : source);
+		target = buf;
+	}
+
+	if (stat(source, &st))
+		return -1;
+
+	if (S_ISDIR(st.st_mode)) {
+		if (!recursive) {
+			errno = EISDIR;
+			return -1;
+		}
+		return copy_tree(source, target, NULL, force);
+	}
+
+	return copy_file(source, target, force);
 }
 
 int format_path(char *path)
@@ -444,25 +880,7 @@ int format_path(char *path)
 
 const char *get_fstype(const char *blk_device)
 {
-	const char *type;
-	blkid_probe pr;
-
-	pr = blkid_new_probe_from_filename(blk_device);
-	if (blkid_do_fullprobe(pr)) {
-		blkid_free_probe(pr);
-		ERROR("Can't probe device %s\n", blk_device);
-		return NULL;
-	}
-
-	if (blkid_probe_lookup_value(pr, "TYPE", &type, NULL) < 0) {
-		blkid_free_probe(pr);
-		ERROR("can't find filesystem on device %s\n", blk_device);
-		return NULL;
-	}
-
-	blkid_free_probe(pr);
-
-	return type;
+	return fstype_cache_get(blk_device);
 }
 
 int make_ext4fs(char *path)
@@ -498,26 +916,8 @@ int check_fs_nomount(char *path)
 
 int patch_vold(void)
 {
-	return sed_replace("/init.rc",
-			   "s/\\/system\\/bin\\/vold/\\/multiboot\\/sbin\\/init voldwrapper/g");
-}
-
-int sed_replace(const char *file, const char *regex)
-{
-	char *par[64];
-	int i = 0;
-
-	// tool
-	par[i++] = PATH_MULTIBOOT_BUSYBOX;
-	par[i++] = "sed";
-	par[i++] = "-i";
-	par[i++] = (char *)regex;
-	par[i++] = (char *)file;
-
-	// end
-	par[i++] = (char *)0;
-
-	return do_exec(par);
+	return rc_patch_add("/init.rc", "/system/bin/vold",
+			    "/multiboot/sbin/init voldwrapper", 0);
 }
 
 int dump_strings(const char *filename, char **result, int size, check_string cb)